@@ -0,0 +1,183 @@
+/***********************************************************************
+BarnesHutTree - Class to approximate the gravitational pull between
+many point masses using a quadtree (2D) or octree (3D) of cells that
+store the total mass and center of mass of the bodies inside them.
+***********************************************************************/
+
+#define BARNESHUTTREE_IMPLEMENTATION
+
+#include <Math/Math.h>
+
+#include "BarnesHutTree.h"
+
+/******************************
+Methods of class BarnesHutTree:
+******************************/
+
+template <class ScalarT, int dimN>
+inline
+void
+BarnesHutTree<ScalarT, dimN>::addBody(
+    int nodeIndex,
+    int bodyIndex)
+{
+    /* Update the node's total mass and center of mass: */
+    Node& node=nodes[nodeIndex];
+    const Body& body=bodies[bodyIndex];
+    node.mass+=body.mass;
+    node.centerOfMass+=(body.position-node.centerOfMass)*(body.mass/node.mass);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+BarnesHutTree<ScalarT, dimN>::split(
+    int nodeIndex)
+{
+    /* Create the node's children: */
+    int firstChild=int(nodes.size());
+    Point center=nodes[nodeIndex].center;
+    Scalar childSize=Math::div2(nodes[nodeIndex].size);
+    for (int childIndex=0;childIndex<numChildren;++childIndex)
+    {
+        Point childCenter;
+        for (int i=0;i<dimension;++i)
+            childCenter[i]=center[i]+(childIndex&(1<<i) ? Math::div2(childSize) : -Math::div2(childSize));
+        nodes.push_back(Node(childCenter,childSize));
+    }
+
+    /* Move the node's bodies into the children: */
+    int bodyIndex=nodes[nodeIndex].bodies;
+    while (bodyIndex>=0)
+    {
+        int succ=bodies[bodyIndex].succ;
+        int childNodeIndex=firstChild+nodes[nodeIndex].getChildIndex(bodies[bodyIndex].position);
+        Node& child=nodes[childNodeIndex];
+        addBody(childNodeIndex,bodyIndex);
+        bodies[bodyIndex].succ=child.bodies;
+        child.bodies=bodyIndex;
+        ++child.numBodies;
+        bodyIndex=succ;
+    }
+
+    /* Turn the node into an interior node: */
+    Node& node=nodes[nodeIndex];
+    node.children=firstChild;
+    node.bodies=-1;
+    node.numBodies=0;
+}
+
+template <class ScalarT, int dimN>
+inline
+BarnesHutTree<ScalarT, dimN>::BarnesHutTree(
+    void)
+{
+    clear(Box(Point::origin,Point::origin));
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+BarnesHutTree<ScalarT, dimN>::clear(
+    const typename BarnesHutTree<ScalarT, dimN>::Box& bounds)
+{
+    nodes.clear();
+    bodies.clear();
+
+    /* Create a cubical root node enclosing the given bounds: */
+    Point center;
+    Scalar size=Scalar(0);
+    for (int i=0;i<dimension;++i)
+    {
+        center[i]=Math::mid(bounds.min[i],bounds.max[i]);
+        if (size<bounds.getSize(i))
+            size=bounds.getSize(i);
+    }
+    nodes.push_back(Node(center,size));
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+BarnesHutTree<ScalarT, dimN>::insert(
+    const typename BarnesHutTree<ScalarT, dimN>::Point& position,
+    typename BarnesHutTree<ScalarT, dimN>::Scalar mass)
+{
+    int bodyIndex=int(bodies.size());
+    bodies.push_back(Body(position,mass));
+
+    /* Descend from the root to the leaf containing the new body: */
+    int nodeIndex=0;
+    for (int depth=0;;++depth)
+    {
+        addBody(nodeIndex,bodyIndex);
+
+        if (nodes[nodeIndex].children<0)
+        {
+            if (nodes[nodeIndex].numBodies<leafSize || depth==maxDepth)
+            {
+                /* Link the body into the leaf's body list: */
+                Node& leaf=nodes[nodeIndex];
+                bodies[bodyIndex].succ=leaf.bodies;
+                leaf.bodies=bodyIndex;
+                ++leaf.numBodies;
+                return;
+            }
+
+            /* Split the full leaf: */
+            split(nodeIndex);
+        }
+
+        nodeIndex=nodes[nodeIndex].children+nodes[nodeIndex].getChildIndex(position);
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+typename BarnesHutTree<ScalarT, dimN>::Vector
+BarnesHutTree<ScalarT, dimN>::calcAcceleration(
+    const typename BarnesHutTree<ScalarT, dimN>::Point& position,
+    typename BarnesHutTree<ScalarT, dimN>::Scalar openingAngle) const
+{
+    Vector result=Vector::zero;
+    Scalar openingAngle2=Math::sqr(openingAngle);
+
+    /* Traverse the tree depth-first: */
+    int stack[maxDepth*(numChildren-1)+1];
+    int stackSize=0;
+    stack[stackSize++]=0;
+    while (stackSize>0)
+    {
+        const Node& node=nodes[stack[--stackSize]];
+        if (node.mass==Scalar(0))
+            continue;
+
+        Vector d=position-node.centerOfMass;
+        Scalar dLen2=Geometry::sqr(d);
+        if (Math::sqr(node.size)<openingAngle2*dLen2)
+        {
+            /* Approximate the node by a point mass at its center of mass: */
+            result-=d*(node.mass/(dLen2*Math::sqrt(dLen2)));
+        }
+        else if (node.children>=0)
+        {
+            /* Open the node: */
+            for (int childIndex=0;childIndex<numChildren;++childIndex)
+                stack[stackSize++]=node.children+childIndex;
+        }
+        else
+        {
+            /* Add the pull of all bodies in the leaf, skipping the body at the query position itself: */
+            for (int bodyIndex=node.bodies;bodyIndex>=0;bodyIndex=bodies[bodyIndex].succ)
+            {
+                const Body& body=bodies[bodyIndex];
+                Vector bd=position-body.position;
+                Scalar bdLen2=Geometry::sqr(bd);
+                if (bdLen2>Scalar(0))
+                    result-=bd*(body.mass/(bdLen2*Math::sqrt(bdLen2)));
+            }
+        }
+    }
+
+    return result;
+}
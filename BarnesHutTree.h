@@ -0,0 +1,99 @@
+/***********************************************************************
+BarnesHutTree - Class to approximate the gravitational pull between
+many point masses using a quadtree (2D) or octree (3D) of cells that
+store the total mass and center of mass of the bodies inside them.
+***********************************************************************/
+
+#ifndef BARNESHUTTREE_INCLUDED
+#define BARNESHUTTREE_INCLUDED
+
+#include <Geometry/Point.h>
+#include <Geometry/Vector.h>
+#include <Geometry/Box.h>
+
+#include <vector>
+
+template <class ScalarParam, int dimensionParam>
+class BarnesHutTree
+{
+public:
+    /* Embedded classes: */
+    typedef ScalarParam Scalar; // Data type for scalars
+    static const int dimension=dimensionParam; // Dimension of the tree
+    typedef Geometry::Point<Scalar, dimensionParam> Point; // Data type for points
+    typedef Geometry::Vector<Scalar, dimensionParam> Vector; // Data type for vectors
+    typedef Geometry::Box<Scalar, dimensionParam> Box; // Data type for axis-aligned boxes
+
+    static const int numChildren=1<<dimensionParam; // Number of children of an interior node
+    static const int leafSize=8; // Maximum number of bodies in a leaf node above the maximum depth
+    static const int maxDepth=32; // Maximum depth of the tree; protects against coincident bodies
+
+private:
+    struct Node // Structure for cubical tree nodes
+    {
+        /* Elements: */
+    public:
+        Point center; // Center of the node's cube
+        Scalar size; // Edge length of the node's cube
+        Scalar mass; // Total mass of all bodies inside the node
+        Point centerOfMass; // Center of mass of all bodies inside the node
+        int children; // Index of the node's first child, or -1 if the node is a leaf
+        int bodies; // Index of the first body in a leaf node, or -1
+        int numBodies; // Number of bodies in a leaf node
+
+        /* Constructors and destructors: */
+        Node(const Point& sCenter, Scalar sSize)
+            :center(sCenter), size(sSize), mass(0), centerOfMass(sCenter),
+             children(-1), bodies(-1), numBodies(0)
+        {
+        }
+
+        /* Methods: */
+        int getChildIndex(const Point& p) const // Returns the index of the child containing the given point
+        {
+            int childIndex=0;
+            for (int i=0;i<dimension;++i)
+                if (p[i]>=center[i])
+                    childIndex|=1<<i;
+            return childIndex;
+        }
+    };
+
+    struct Body // Structure for point masses
+    {
+        /* Elements: */
+    public:
+        Point position; // Position of the body
+        Scalar mass; // Mass of the body
+        int succ; // Index of the next body in the same leaf node, or -1
+
+        /* Constructors and destructors: */
+        Body(const Point& sPosition, Scalar sMass)
+            :position(sPosition), mass(sMass), succ(-1)
+        {
+        }
+    };
+
+    /* Elements: */
+    std::vector<Node> nodes; // Array of tree nodes; the root is node 0
+    std::vector<Body> bodies; // Array of all bodies in the tree
+
+    /* Private methods: */
+    void addBody(int nodeIndex, int bodyIndex); // Adds a body to the mass distribution of a node
+    void split(int nodeIndex); // Splits a leaf node and distributes its bodies to the new children
+
+    /* Constructors and destructors: */
+public:
+    BarnesHutTree(void); // Creates an empty tree
+
+    /* Methods: */
+    void clear(const Box& bounds); // Removes all bodies and sets the region covered by the root node
+    void insert(const Point& position, Scalar mass); // Inserts a point mass into the tree
+    Vector calcAcceleration(const Point& position, Scalar openingAngle) const; // Returns the acceleration at the given position due to all bodies; nodes seen under less than the opening angle are approximated by their center of mass
+};
+
+#ifndef BARNESHUTTREE_IMPLEMENTATION
+#include "BarnesHutTree.cpp"
+#endif
+
+#endif
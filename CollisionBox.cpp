@@ -1,13 +1,19 @@
 /***********************************************************************
 CollisionBox - Class to represent a rectangular box containing spheres
-of a fixed radius interacting by fully elastic collisions.
+of a fixed radius interacting by elastic or inelastic collisions.
 Copyright (c) 2005 Oliver Kreylos
 ***********************************************************************/
 
 #define COLLISIONBOX_IMPLEMENTATION
 
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <Misc/Timer.h>
 #include <Math/Math.h>
+#include <Math/Constants.h>
 
+#include "ParticleKernels.h"
 #include "CollisionBox.h"
 
 /*****************************
@@ -17,67 +23,461 @@ Methods of class CollisionBox:
 template <class ScalarT, int dimN>
 inline
 void
-CollisionBox<ScalarT, dimN>::queueCollisionsInCell(
+CollisionBox<ScalarT, dimN>::findParticleCollision(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle1,
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle2,
+    typename CollisionBox<ScalarT, dimN>::CollisionEvent& nextCollision)
+{
+    /* Calculate any possible intersection time between the two particles: */
+    Vector d=positions[particle1]-positions[particle2];
+    d-=velocities[particle1]*timeStamps[particle1];
+    d+=velocities[particle2]*timeStamps[particle2];
+    Vector vd=velocities[particle1]-velocities[particle2];
+    Scalar vd2=Geometry::sqr(vd);
+    if (vd2>Scalar(0)) // Are the two particles' velocities different?
+    {
+        /* Solve the quadratic equation determining possible collisions: */
+        Scalar ph=(d*vd)/vd2;
+        Scalar q=(Geometry::sqr(d)-Scalar(4)*particleRadius2)/vd2;
+        Scalar det=Math::sqr(ph)-q;
+        if (det>=Scalar(0)) // Are there any solutions?
+        {
+            /* Calculate the first solution (only that can be valid): */
+            Scalar collisionTime=-ph-Math::sqrt(det);
+
+            /* If the collision is valid, i.e., occurs past the last update of both particles, and is the earliest so far, keep it: */
+            if (collisionTime>timeStamps[particle1] && collisionTime>timeStamps[particle2] && collisionTime<=nextCollision.collisionTime)
+                nextCollision=CollisionEvent(collisionTime,particle2,particleStates[particle2].eventCounter);
+        }
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::findCollisionsInCell(
     typename CollisionBox<ScalarT, dimN>::GridCell* cell,
-    typename CollisionBox<ScalarT, dimN>::Particle* particle1,
-    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle1,
     bool symmetric,
-    typename CollisionBox<ScalarT, dimN>::Particle* otherParticle,
-    typename CollisionBox<ScalarT, dimN>::CollisionQueue& collisionQueue)
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex otherParticle,
+    typename CollisionBox<ScalarT, dimN>::CollisionEvent& nextCollision)
 {
     /* Calculate all intersections between two particles: */
-    for (Particle* particle2=cell->particlesHead;particle2!=0;particle2=particle2->cellSucc)
+    auto checkParticle=[this,particle1,symmetric,otherParticle,&nextCollision](ParticleIndex particle2) {
+        if (particle2!=particle1 && particle2!=otherParticle && (symmetric||particle2>particle1||particleStates[particle2].asleep))
+            findParticleCollision(particle1,particle2,nextCollision);
+    };
+    cell->forEachParticle(&particleStates[0],checkParticle);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::createCells(
+    typename CollisionBox<ScalarT, dimN>::Scalar newCellSizeFactor)
+{
+    /* Calculate the number of cells and cell sizes: */
+    cellSizeFactor=newCellSizeFactor;
+    Scalar cellEdge=particleRadius*Scalar(2)*cellSizeFactor;
+    Scalar neighborRange=particleRadius*Scalar(2)+neighborSkin; // Largest distance between particles, or neighbor list centers, that have to be checked against each other
+    stencilRadius=int(Math::ceil(neighborRange/cellEdge)); // Particles that far apart are at most this many cells apart
+    Index numOuterCells;
+    for (int i=0;i<dimension;++i)
+    {
+        numCells[i]=int(Math::floor(boundaries.getSize(i)/cellEdge));
+        if (numCells[i]<1)
+            numCells[i]=1;
+        cellSize[i]=boundaries.getSize(i)/Scalar(numCells[i]);
+        numOuterCells[i]=numCells[i]+2*stencilRadius; // Create layers of "ghost cells" in all directions as deep as the neighbor stencil reaches
+    }
+    
+    /* Create the cell array of empty cells in the current layout: */
+    cells.resize(numOuterCells,cells.getLayout());
+    
+    /* Initialize the neighbor array: */
+    delete[] neighborOffsets;
+    delete[] cellChangeMasks;
+    numNeighbors=1;
+    for (int i=0;i<dimension;++i)
+        numNeighbors*=2*stencilRadius+1;
+    neighborOffsets=new Index[numNeighbors];
+    cellChangeMasks=new int[numNeighbors];
+    Index minBound(-stencilRadius);
+    Index maxBound(stencilRadius+1);
+    int neighborIndex=0;
+    for (Index index=minBound;index[0]<maxBound[0];index.preInc(minBound,maxBound),++neighborIndex)
     {
-        if (particle2!=particle1 && particle2!=otherParticle && (symmetric||particle2>particle1))
+        neighborOffsets[neighborIndex]=index;
+        cellChangeMasks[neighborIndex]=0x0;
+        for (int i=0;i<dimension;++i)
         {
-            /* Calculate any possible intersection time between the two particles: */
-            Vector d=particle1->position-particle2->position;
-            d-=particle1->velocity*particle1->timeStamp;
-            d+=particle2->velocity*particle2->timeStamp;
-            Vector vd=particle1->velocity-particle2->velocity;
-            Scalar vd2=Geometry::sqr(vd);
-            if (vd2>Scalar(0)) // Are the two particles' velocities different?
-            {
-                /* Solve the quadratic equation determining possible collisions: */
-                Scalar ph=(d*vd)/vd2;
-                Scalar q=(Geometry::sqr(d)-Scalar(4)*particleRadius2)/vd2;
-                Scalar det=Math::sqr(ph)-q;
-                if (det>=Scalar(0)) // Are there any solutions?
-                {
-                    /* Calculate the first solution (only that can be valid): */
-                    Scalar collisionTime=-ph-Math::sqrt(det);
+            if (index[i]==-stencilRadius)
+                cellChangeMasks[neighborIndex]|=1<<(2*i+0);
+            else if (index[i]==stencilRadius)
+                cellChangeMasks[neighborIndex]|=1<<(2*i+1);
+        }
+    }
+}
 
-                    /* If the collision is valid, i.e., occurs past the last update of both particles, queue it: */
-                    if (collisionTime>particle1->timeStamp && collisionTime>particle2->timeStamp && collisionTime<=timeStep)
-                        collisionQueue.insert(CollisionEvent(collisionTime,particle1,particle2));
-                }
-            }
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::Index
+CollisionBox<ScalarT, dimN>::calcCellIndex(
+    const typename CollisionBox<ScalarT, dimN>::Point& position) const
+{
+    Index result;
+    for (int i=0;i<dimension;++i)
+    {
+        int cell=int(Math::floor((position[i]-boundaries.min[i])/cellSize[i]));
+        if (cell<0)
+            cell=0;
+        else if (cell>=numCells[i])
+            cell=numCells[i]-1;
+        result[i]=cell+stencilRadius;
+    }
+    return result;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::rebuildCells(
+    void)
+{
+    /* Sort the particles into the grid cells containing their current positions, which must be empty: */
+    listCenters.clear();
+    neighborLists.clear();
+    sortedCells.clear();
+    for (size_t i=0;i<numParticles;++i)
+        particleStates[i].cell=calcCellIndex(positions[i]);
+    sortParticles();
+    
+    if (neighborSkin>Scalar(0))
+    {
+        /* Center all neighbor lists at the particles' current positions and collect each pair of neighbors once: */
+        listCenters=positions;
+        neighborLists.resize(numParticles);
+        for (size_t i=0;i<numParticles;++i)
+            buildNeighborList(ParticleIndex(i),false);
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::moveToCell(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    const typename CollisionBox<ScalarT, dimN>::Index& newCell)
+{
+    ParticleState& ps=particleStates[particle];
+    if (ps.inSortedCell)
+    {
+        /* Leave the particle in the cell's sorted range, but skip it from now on: */
+        ps.inSortedCell=false;
+        ++numUnsortedParticles;
+    }
+    else
+        cells.getAddress(ps.cell)->removeParticle(particle,&particleStates[0]);
+    ps.cell=newCell;
+    cells.getAddress(ps.cell)->addParticle(particle,&particleStates[0]);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::buildNeighborList(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    bool symmetric)
+{
+    /* Find all particles whose list centers are in range of the particle's in the grid cells around it: */
+    Scalar neighborRange2=Math::sqr(particleRadius*Scalar(2)+neighborSkin);
+    const Point& center=listCenters[particle];
+    auto checkParticle=[this,particle,symmetric,&center,neighborRange2](ParticleIndex particle2) {
+        if (particle2!=particle && (symmetric||particle2>particle) && Geometry::sqrDist(listCenters[particle2],center)<=neighborRange2)
+        {
+            neighborLists[particle].push_back(particle2);
+            neighborLists[particle2].push_back(particle);
         }
+    };
+    const Index& baseCell=particleStates[particle].cell;
+    for (int i=0;i<numNeighbors;++i)
+        cells.getAddress(baseCell,neighborOffsets[i])->forEachParticle(&particleStates[0],checkParticle);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::unlinkNeighbors(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle)
+{
+    const std::vector<ParticleIndex>& neighbors=neighborLists[particle];
+    for (typename std::vector<ParticleIndex>::const_iterator nIt=neighbors.begin();nIt!=neighbors.end();++nIt)
+    {
+        /* Replace the particle in the neighbor's list by the list's last entry: */
+        std::vector<ParticleIndex>& neighborList=neighborLists[*nIt];
+        *std::find(neighborList.begin(),neighborList.end(),particle)=neighborList.back();
+        neighborList.pop_back();
     }
 }
 
 template <class ScalarT, int dimN>
+template <class FunctorParam>
 inline
 void
-CollisionBox<ScalarT, dimN>::queueCellChanges(
-    typename CollisionBox<ScalarT, dimN>::Particle* particle,
-    const typename CollisionBox<ScalarT, dimN>::Point& newPosition,
-    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
-    typename CollisionBox<ScalarT, dimN>::CollisionQueue& collisionQueue)
+CollisionBox<ScalarT, dimN>::forEachNeighbor(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    FunctorParam& functor)
+{
+    if (neighborSkin>Scalar(0))
+    {
+        const std::vector<ParticleIndex>& neighbors=neighborLists[particle];
+        for (typename std::vector<ParticleIndex>::const_iterator nIt=neighbors.begin();nIt!=neighbors.end();++nIt)
+            functor(*nIt);
+    }
+    else
+    {
+        const Index& baseCell=particleStates[particle].cell;
+        for (int i=0;i<numNeighbors;++i)
+            cells.getAddress(baseCell,neighborOffsets[i])->forEachParticle(&particleStates[0],functor);
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::schedulePrediction(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle)
+{
+    /* Remember where the particle is listed, so that removing it does not have to search the list: */
+    ParticleState& ps=particleStates[particle];
+    ps.predictionPending=true;
+    ps.pendingPosition=(unsigned int)(pendingParticles.size());
+    pendingParticles.push_back(particle);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::fallAsleep(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle)
+{
+    /* Stop the particle and drop its queued event; outdate all collisions predicted with it while it was moving: */
+    ParticleState& ps=particleStates[particle];
+    ps.asleep=true;
+    ++numSleepingParticles;
+    velocities[particle]=Vector::zero;
+    ps.lastPartner=noParticle; // Collision times are not moved into later steps' time frames while the particle is parked
+    ps.lastImpactTime=-Math::Constants<Scalar>::max;
+    ++ps.eventCounter;
+    if (collisionQueue.contains(particle))
+        collisionQueue.remove(particle);
+    
+    /* Let the active neighbors of the particle find their collisions with it at the beginning of the next step, unless the queue is rebuilt anyway: */
+    if (persistentQueue)
+    {
+        auto scheduleFn=[this,particle](ParticleIndex neighbor) {
+            ParticleState& ns=particleStates[neighbor];
+            if (neighbor!=particle && !ns.asleep && !ns.predictionPending)
+                schedulePrediction(neighbor);
+        };
+        forEachNeighbor(particle,scheduleFn);
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::wakeParticle(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle)
+{
+    ParticleState& ps=particleStates[particle];
+    ps.asleep=false;
+    ps.restTime=Scalar(0);
+    --numSleepingParticles;
+    if (persistentQueue && !ps.predictionPending)
+        schedulePrediction(particle);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::wakeContacts(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    typename CollisionBox<ScalarT, dimN>::Scalar time,
+    typename CollisionBox<ScalarT, dimN>::Scalar timeStep)
+{
+    /* Wake all parked particles within a tenth of a radius of touching the particle, which might have rested on it: */
+    Scalar contactDistance2=Math::sqr(particleRadius*Scalar(2.1));
+    const Point& position=positions[particle];
+    auto wakeFn=[this,particle,time,timeStep,contactDistance2,&position](ParticleIndex neighbor) {
+        ParticleState& ns=particleStates[neighbor];
+        if (neighbor!=particle && ns.asleep && Geometry::sqrDist(positions[neighbor],position)<=contactDistance2)
+        {
+            ns.asleep=false;
+            ns.restTime=Scalar(0);
+            --numSleepingParticles;
+            timeStamps[neighbor]=time;
+            queueCollisions(neighbor,timeStep,true,noParticle);
+        }
+    };
+    forEachNeighbor(particle,wakeFn);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::wakeSphereContacts(
+    typename CollisionBox<ScalarT, dimN>::Scalar timeStep)
+{
+    /* Calculate the region swept by the spherical obstacle during the step, including the particles it can touch: */
+    Point sphereEnd=spherePosition+sphereVelocity*(timeStep-sphereTimeStamp);
+    Scalar reach=sphereRadius+particleRadius*Scalar(1.1);
+    Scalar cellReach=reach+Math::div2(neighborSkin); // Grid cells hold particles by their list centers while neighbor lists are used
+    Point regionMin,regionMax;
+    for (int i=0;i<dimension;++i)
+    {
+        regionMin[i]=std::min(spherePosition[i],sphereEnd[i])-cellReach;
+        regionMax[i]=std::max(spherePosition[i],sphereEnd[i])+cellReach;
+        if (regionMax[i]<boundaries.min[i]||regionMin[i]>boundaries.max[i])
+            return; // The obstacle stays outside the box
+    }
+    
+    /* Wake all parked particles within reach of the obstacle's path in the grid cells overlapping the region: */
+    Vector path=sphereEnd-spherePosition;
+    Scalar pathLength2=Geometry::sqr(path);
+    Scalar reach2=Math::sqr(reach);
+    auto wakeFn=[this,&sphereEnd,&path,pathLength2,reach2](ParticleIndex particle) {
+        if (particleStates[particle].asleep)
+        {
+            /* Find the point on the obstacle's path closest to the particle: */
+            Vector d=positions[particle]-spherePosition;
+            Scalar t=pathLength2>Scalar(0) ? (d*path)/pathLength2 : Scalar(0);
+            if (t<Scalar(0))
+                t=Scalar(0);
+            else if (t>Scalar(1))
+                t=Scalar(1);
+            if (Geometry::sqr(d-path*t)<=reach2)
+                wakeParticle(particle);
+        }
+    };
+    Index minCell=calcCellIndex(regionMin);
+    Index maxCell=calcCellIndex(regionMax);
+    for (int i=0;i<dimension;++i)
+        ++maxCell[i];
+    for (Index cell=minCell;cell[0]<maxCell[0];cell.preInc(minCell,maxCell))
+        cells.getAddress(cell)->forEachParticle(&particleStates[0],wakeFn);
+}
+
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::Scalar
+CollisionBox<ScalarT, dimN>::findCellSizeFactor(
+    void) const
+{
+    /* Neighbor lists replace cell changes, which the cell size is tuned to avoid: */
+    if (neighborSkin>Scalar(0))
+        return cellSizeFactor;
+    
+    /* Measure the particles' mean speed and mean sum of absolute velocity components: */
+    size_t numActiveParticles=numParticles-numRemovedParticles;
+    Scalar speedSum(0);
+    Scalar componentSum(0);
+    for (size_t i=0;i<numParticles;++i)
+        if (particleStates[i].handle!=noHandle)
+        {
+            speedSum+=Math::sqrt(Geometry::sqr(velocities[i]));
+            for (int j=0;j<dimension;++j)
+                componentSum+=Math::abs(velocities[i][j]);
+        }
+    if (numActiveParticles==0||speedSum==Scalar(0))
+        return cellSizeFactor;
+    Scalar meanSpeed=speedSum/Scalar(numActiveParticles);
+    Scalar meanComponentSum=componentSum/Scalar(numActiveParticles);
+    
+    /* Measure the particles' number density: */
+    Scalar volume(1);
+    for (int i=0;i<dimension;++i)
+        volume*=boundaries.getSize(i);
+    Scalar density=Scalar(numActiveParticles)/volume;
+    
+    /* Calculate the mean free path from the last step's collision rate, or from the density of an ideal gas before any collisions were counted: */
+    Scalar diameter=particleRadius*Scalar(2);
+    Scalar collisionRate; // Number of collisions per particle and time unit
+    if (collectStats&&lastTimeStep>Scalar(0)&&stepStats.numParticleCollisions>0)
+        collisionRate=Scalar(2*stepStats.numParticleCollisions)/(Scalar(numActiveParticles)*lastTimeStep); // Assumes the last step was as long as the current one
+    else
+    {
+        Scalar crossSection=dimension==2 ? Scalar(2)*diameter : Math::Constants<Scalar>::pi*Math::sqr(diameter);
+        collisionRate=Math::sqrt(Scalar(2))*meanSpeed*density*crossSection;
+    }
+    Scalar meanFreePath=meanSpeed/collisionRate;
+    
+    /* Estimate the work per particle and time unit in units of particle pair tests: */
+    const Scalar eventCost(20); // Queue operations and wall and obstacle tests of a single event
+    const Scalar cellCost(1); // Visiting a single grid cell
+    auto estimateWork=[=](Scalar factor) {
+        Scalar cellEdge=diameter*factor;
+        int radius=int(Math::ceil(Scalar(1)/factor));
+        Scalar cellParticles=density*Math::pow(cellEdge,Scalar(dimension));
+        Scalar faceCells=Math::pow(Scalar(2*radius+1),Scalar(dimension-1));
+        Scalar stencilCells=faceCells*Scalar(2*radius+1);
+        
+        /* A collision re-predicts its particles against the whole stencil, a cell change only against the cells entering it: */
+        Scalar predictionWork=eventCost+stencilCells*(cellParticles+cellCost);
+        Scalar collisionWork=(meanSpeed/meanFreePath)*predictionWork;
+        Scalar cellChangeWork=(meanComponentSum/cellEdge)*(eventCost+faceCells*(cellParticles+cellCost));
+        
+        /* Without a persistent queue, every step re-predicts all particles: */
+        Scalar rebuildWork=!persistentQueue&&lastTimeStep>Scalar(0) ? predictionWork/lastTimeStep : Scalar(0);
+        
+        return collisionWork+cellChangeWork+rebuildWork;
+    };
+    
+    /* Only switch to a factor that is clearly better, since re-creating the grid invalidates all predicted collisions: */
+    Scalar bestFactor=cellSizeFactor;
+    Scalar bestWork=estimateWork(cellSizeFactor)*Scalar(0.9);
+    Scalar maxCellEdge=boundaries.getSize(0);
+    for (int i=1;i<dimension;++i)
+        if (maxCellEdge>boundaries.getSize(i))
+            maxCellEdge=boundaries.getSize(i);
+    for (Scalar factor(0.5);factor*diameter<=maxCellEdge;factor*=Scalar(1.25))
+    {
+        Scalar work=estimateWork(factor);
+        if (bestWork>work)
+        {
+            bestFactor=factor;
+            bestWork=work;
+        }
+    }
+    
+    return bestFactor;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::findCellChange(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    typename CollisionBox<ScalarT, dimN>::CollisionEvent& nextCollision)
 {
-    /* Check for crossing of any cell borders: */
-    GridCell* cell=particle->cell;
-    Scalar cellChangeTime=timeStep;
+    /* Check for crossing of any cell borders; cell index stencilRadius is the first interior cell: */
+    const Index& cell=particleStates[particle].cell;
+    const Point& position=positions[particle];
+    const Vector& velocity=velocities[particle];
+    Scalar timeStamp=timeStamps[particle];
+    Scalar cellChangeTime=nextCollision.collisionTime;
     int cellChangeDirection=-1;
     for (int i=0;i<dimension;++i) {
-        if (newPosition[i]<cell->boundaries.min[i]) {
-            Scalar collisionTime=particle->timeStamp+(cell->boundaries.min[i]-particle->position[i])/particle->velocity[i];
+        if (velocity[i]<Scalar(0)) {
+            Scalar cellMin=boundaries.min[i]+cellSize[i]*Scalar(cell[i]-stencilRadius);
+            Scalar collisionTime=timeStamp+(cellMin-position[i])/velocity[i];
             if (cellChangeTime>collisionTime) {
                 cellChangeTime=collisionTime;
                 cellChangeDirection=2*i+0;
             }
-        } else if (newPosition[i]>cell->boundaries.max[i]) {
-            Scalar collisionTime=particle->timeStamp+(cell->boundaries.max[i]-particle->position[i])/particle->velocity[i];
+        } else if (velocity[i]>Scalar(0)) {
+            Scalar cellMax=boundaries.min[i]+cellSize[i]*Scalar(cell[i]-stencilRadius+1);
+            Scalar collisionTime=timeStamp+(cellMax-position[i])/velocity[i];
             if (cellChangeTime>collisionTime) {
                 cellChangeTime=collisionTime;
                 cellChangeDirection=2*i+1;
@@ -85,55 +485,48 @@ CollisionBox<ScalarT, dimN>::queueCellChanges(
         }
     }
     if (cellChangeDirection>=0) {
-        collisionQueue.insert(CollisionEvent(cellChangeTime,particle,cellChangeDirection));
+        nextCollision=CollisionEvent(cellChangeTime,CollisionEvent::CellChange,cellChangeDirection);
     }
 }
 
 template <class ScalarT, int dimN>
 inline
 void
-CollisionBox<ScalarT, dimN>::queueCollisions(
-    typename CollisionBox<ScalarT, dimN>::Particle* particle1,
-    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
-    bool symmetric,
-    typename CollisionBox<ScalarT, dimN>::Particle* otherParticle,
-    typename CollisionBox<ScalarT, dimN>::CollisionQueue& collisionQueue)
+CollisionBox<ScalarT, dimN>::findListExit(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    typename CollisionBox<ScalarT, dimN>::CollisionEvent& nextCollision)
 {
-    /* Calculate the particle's position at the end of this time step: */
-    Point newPosition=particle1->position+particle1->velocity*(timeStep-particle1->timeStamp);
-    
-    /* Check for crossing of cell borders: */
-    queueCellChanges(particle1,newPosition,timeStep,collisionQueue);
-    
-    /* Check for collision with any of the collision box's walls: */
-    for (int i=0;i<dimension;++i) {
-        if (newPosition[i]<boundaries.min[i]+particleRadius) {
-            Scalar collisionTime=particle1->timeStamp+(boundaries.min[i]+particleRadius-particle1->position[i])/particle1->velocity[i];
-            if (collisionTime<particle1->timeStamp)
-                collisionTime=particle1->timeStamp;
-            else if (collisionTime>timeStep)
-                collisionTime=timeStep;
-            Vector wallNormal=Vector::zero;
-            wallNormal[i]=Scalar(1);
-            collisionQueue.insert(CollisionEvent(collisionTime,particle1,wallNormal));
-        }
-        else if (newPosition[i]>boundaries.max[i]-particleRadius) {
-            Scalar collisionTime=particle1->timeStamp+(boundaries.max[i]-particleRadius-particle1->position[i])/particle1->velocity[i];
-            if (collisionTime<particle1->timeStamp)
-                collisionTime=particle1->timeStamp;
-            else if (collisionTime>timeStep)
-                collisionTime=timeStep;
-            Vector wallNormal=Vector::zero;
-            wallNormal[i]=Scalar(-1);
-            collisionQueue.insert(CollisionEvent(collisionTime,particle1,wallNormal));
-        }
-    }
+    /* Check when the particle moves half the skin away from its neighbor list's center: */
+    const Vector& velocity=velocities[particle];
+    Scalar v2=Geometry::sqr(velocity);
+    if (v2==Scalar(0))
+        return;
+    Vector d=positions[particle]-listCenters[particle];
+    Scalar ph=(d*velocity)/v2;
+    Scalar q=(Geometry::sqr(d)-Math::sqr(Math::div2(neighborSkin)))/v2;
+    Scalar det=Math::sqr(ph)-q;
     
+    /* The list center usually lies ahead of the particle's time stamp, so take the later solution; update immediately if the particle already left the sphere around its list center: */
+    Scalar exitTime=timeStamps[particle];
+    if (det>=Scalar(0) && Math::sqrt(det)>ph)
+        exitTime+=-ph+Math::sqrt(det);
+    if (nextCollision.collisionTime>exitTime)
+        nextCollision=CollisionEvent(exitTime,CollisionEvent::NeighborListUpdate,0);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::findSphereCollision(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
+    typename CollisionBox<ScalarT, dimN>::CollisionEvent& nextCollision)
+{
     /* Check for collision with the spherical obstacle: */
-    Vector d=particle1->position-spherePosition;
-    d-=particle1->velocity*particle1->timeStamp;
+    Vector d=positions[particle]-spherePosition;
+    d-=velocities[particle]*timeStamps[particle];
     d+=sphereVelocity*sphereTimeStamp;
-    Vector vd=particle1->velocity-sphereVelocity;
+    Vector vd=velocities[particle]-sphereVelocity;
     Scalar vd2=Geometry::sqr(vd);
     if (vd2>Scalar(0)) { // Are the two particles' velocities different?
         /* Solve the quadratic equation determining possible collisions: */
@@ -144,45 +537,324 @@ CollisionBox<ScalarT, dimN>::queueCollisions(
             /* Calculate the first solution (only that can be valid): */
             Scalar collisionTime=-ph-Math::sqrt(det);
 
-            /* If the collision is valid, i.e., occurs past the last update of both particles, queue it: */
-            if (collisionTime>particle1->timeStamp && collisionTime>sphereTimeStamp && collisionTime<=timeStep) {
-                collisionQueue.insert(CollisionEvent(collisionTime,particle1,sphereTimeStamp));
+            /* If the collision is valid, i.e., occurs past the last update of both particles, and is the earliest so far, keep it: */
+            if (collisionTime>timeStamps[particle] && collisionTime>sphereTimeStamp && collisionTime<=timeStep && collisionTime<=nextCollision.collisionTime) {
+                nextCollision=CollisionEvent(collisionTime,CollisionEvent::SphereCollision,sphereEventCounter);
             }
         }
     }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::queueNextEvent(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle)
+{
+    /* Find the earlier of the particle's next collision and its next cell change or neighbor list update: */
+    CollisionEvent nextEvent=nextCollisions[particle];
+    if (neighborSkin>Scalar(0))
+        findListExit(particle,nextEvent);
+    else
+        findCellChange(particle,nextEvent);
     
-    /* Check for collision with any other particle: */
-    GridCell* baseCell=particle1->cell;
-    for (int i=0;i<numNeighbors;++i)
+    /* Replace the particle's queued event: */
+    if (nextEvent.getCollisionType()!=CollisionEvent::NoCollision)
     {
-        GridCell* cell=baseCell+neighborOffsets[i];
-        queueCollisionsInCell(cell,particle1,timeStep,symmetric,otherParticle,collisionQueue);
+        collisionQueue.replace(particle,nextEvent);
+        if (collectStats)
+        {
+            switch (nextEvent.getCollisionType())
+            {
+                case CollisionEvent::CellChange:
+                    ++stepStats.numQueuedCellChanges;
+                    break;
+                case CollisionEvent::NeighborListUpdate:
+                    ++stepStats.numQueuedListUpdates;
+                    break;
+                case CollisionEvent::WallCollision:
+                    ++stepStats.numQueuedWallCollisions;
+                    break;
+                case CollisionEvent::SphereCollision:
+                    ++stepStats.numQueuedSphereCollisions;
+                    break;
+                default:
+                    ++stepStats.numQueuedParticleCollisions;
+            }
+            if (stepStats.maxQueuedEvents<collisionQueue.getNumElements())
+                stepStats.maxQueuedEvents=collisionQueue.getNumElements();
+        }
     }
+    else if (collisionQueue.contains(particle))
+        collisionQueue.remove(particle);
 }
 
 template <class ScalarT, int dimN>
 inline
 void
-CollisionBox<ScalarT, dimN>::queueCollisionsOnCellChange(
-    typename CollisionBox<ScalarT, dimN>::Particle* particle,
+CollisionBox<ScalarT, dimN>::predictCollisions(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle1,
     typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
-    int cellChangeDirection,
-    typename CollisionBox<ScalarT, dimN>::CollisionQueue& collisionQueue)
+    bool symmetric,
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex otherParticle)
 {
-    /* Calculate the particle's position at the end of this time step: */
-    Point newPosition=particle->position+particle->velocity*(timeStep-particle->timeStamp);
+    CollisionEvent nextCollision(predictionHorizon);
     
-    /* Check for crossing of cell borders: */
-    queueCellChanges(particle,newPosition,timeStep,collisionQueue);
+    /* Check for collision with any of the collision box's walls: */
+    const Point& position=positions[particle1];
+    const Vector& velocity=velocities[particle1];
+    Scalar timeStamp=timeStamps[particle1];
+    for (int i=0;i<dimension;++i) {
+        if (velocity[i]<Scalar(0)) {
+            Scalar collisionTime=timeStamp+(boundaries.min[i]+particleRadius-position[i])/velocity[i];
+            if (collisionTime<timeStamp)
+                collisionTime=timeStamp;
+            if (collisionTime<=nextCollision.collisionTime)
+                nextCollision=CollisionEvent(collisionTime,CollisionEvent::WallCollision,2*i+0);
+        }
+        else if (velocity[i]>Scalar(0)) {
+            Scalar collisionTime=timeStamp+(boundaries.max[i]-particleRadius-position[i])/velocity[i];
+            if (collisionTime<timeStamp)
+                collisionTime=timeStamp;
+            if (collisionTime<=nextCollision.collisionTime)
+                nextCollision=CollisionEvent(collisionTime,CollisionEvent::WallCollision,2*i+1);
+        }
+    }
+    
+    /* Check for collision with the spherical obstacle: */
+    findSphereCollision(particle1,timeStep,nextCollision);
     
     /* Check for collision with any other particle: */
-    GridCell* baseCell=particle->cell;
+    if (neighborSkin>Scalar(0))
+    {
+        const std::vector<ParticleIndex>& neighbors=neighborLists[particle1];
+        for (typename std::vector<ParticleIndex>::const_iterator nIt=neighbors.begin();nIt!=neighbors.end();++nIt)
+            if (*nIt!=otherParticle && (symmetric||*nIt>particle1||particleStates[*nIt].asleep))
+                findParticleCollision(particle1,*nIt,nextCollision);
+    }
+    else
+    {
+        const Index& baseCell=particleStates[particle1].cell;
+        for (int i=0;i<numNeighbors;++i)
+        {
+            GridCell* cell=cells.getAddress(baseCell,neighborOffsets[i]);
+            findCollisionsInCell(cell,particle1,symmetric,otherParticle,nextCollision);
+        }
+    }
+    
+    /* Store the earliest of the particle's collisions: */
+    nextCollisions[particle1]=nextCollision;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::queueCollisions(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle1,
+    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
+    bool symmetric,
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex otherParticle)
+{
+    /* Queue the earliest of the particle's collisions and its next cell change: */
+    predictCollisions(particle1,timeStep,symmetric,otherParticle);
+    queueNextEvent(particle1);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::queueCollisionsOnCellChange(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    int cellChangeDirection)
+{
+    /* Check for collision with any particle in the cells that just became neighbors: */
+    CollisionEvent& nextCollision=nextCollisions[particle];
+    const Index& baseCell=particleStates[particle].cell;
     for (int i=0;i<numNeighbors;++i)
         if (cellChangeMasks[i]&(1<<cellChangeDirection))
         {
-            GridCell* cell=baseCell+neighborOffsets[i];
-            queueCollisionsInCell(cell,particle,timeStep,true,0,collisionQueue);
+            GridCell* cell=cells.getAddress(baseCell,neighborOffsets[i]);
+            findCollisionsInCell(cell,particle,true,noParticle,nextCollision);
         }
+    
+    /* Queue the earliest of the particle's collisions and its next cell change: */
+    queueNextEvent(particle);
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::sortParticles(
+    void)
+{
+    /* Empty the sorted ranges of all grid cells, which all have to be in the list of sorted cells: */
+    GridCell* cellBase=cells.getArray();
+    for (std::vector<ptrdiff_t>::iterator scIt=sortedCells.begin();scIt!=sortedCells.end();++scIt)
+    {
+        cellBase[*scIt].sortedBegin=0;
+        cellBase[*scIt].sortedEnd=0;
+    }
+    sortedCells.clear();
+    
+    /* Count the particles in each grid cell, and empty all lists of moved particles: */
+    std::vector<ptrdiff_t> particleCells(numParticles);
+    for (size_t i=0;i<numParticles;++i)
+    {
+        if (particleStates[i].handle==noHandle)
+            continue;
+        particleCells[i]=cells.calcLinearIndex(particleStates[i].cell);
+        GridCell& cell=cellBase[particleCells[i]];
+        cell.movedHead=noParticle;
+        if (cell.sortedEnd==0)
+            sortedCells.push_back(particleCells[i]);
+        ++cell.sortedEnd;
+    }
+    
+    /* Bring the occupied cells into memory order; scanning all cells is cheaper than sorting once most cells are occupied: */
+    size_t numAllCells=cells.getNumElements();
+    if (sortedCells.size()*16>=numAllCells)
+    {
+        sortedCells.clear();
+        for (size_t i=0;i<numAllCells;++i)
+            if (cellBase[i].sortedEnd!=0)
+                sortedCells.push_back(ptrdiff_t(i));
+    }
+    else
+        std::sort(sortedCells.begin(),sortedCells.end());
+    
+    /* Assign consecutive particle ranges to the occupied cells in memory order: */
+    ParticleIndex rangeBegin=0;
+    for (std::vector<ptrdiff_t>::iterator scIt=sortedCells.begin();scIt!=sortedCells.end();++scIt)
+    {
+        GridCell& cell=cellBase[*scIt];
+        ParticleIndex count=cell.sortedEnd;
+        cell.sortedBegin=rangeBegin;
+        cell.sortedEnd=rangeBegin; // Used as insertion point while distributing the particles
+        rangeBegin+=count;
+    }
+    
+    /* Distribute the particles into their cells' ranges, keeping their relative order: */
+    std::vector<ParticleIndex> order(numParticles-numRemovedParticles); // Old index of the particle at each new index
+    for (size_t i=0;i<numParticles;++i)
+        if (particleStates[i].handle!=noHandle)
+            order[cellBase[particleCells[i]].sortedEnd++]=ParticleIndex(i);
+    
+    std::vector<ParticleIndex> newIndices(numParticles,ParticleIndex(noParticle)); // New index of the particle at each old index, or noParticle for removed particles
+    numParticles-=numRemovedParticles;
+    numRemovedParticles=0;
+    for (size_t i=0;i<numParticles;++i)
+    {
+        newIndices[order[i]]=ParticleIndex(i);
+        handleIndices[particleStates[order[i]].handle]=ParticleIndex(i);
+    }
+    
+    /* Permute the particle arrays: */
+    std::vector<Point> newPositions(numParticles);
+    std::vector<Vector> newVelocities(numParticles);
+    std::vector<Scalar> newTimeStamps(numParticles);
+    std::vector<ParticleState> newParticleStates(numParticles,ParticleState(Index(0)));
+    std::vector<CollisionEvent> newNextCollisions(numParticles,CollisionEvent(Scalar(0)));
+    for (size_t i=0;i<numParticles;++i)
+    {
+        newPositions[i]=positions[order[i]];
+        newVelocities[i]=velocities[order[i]];
+        newTimeStamps[i]=timeStamps[order[i]];
+        ParticleState& ps=newParticleStates[i];
+        ps=particleStates[order[i]];
+        ps.cellPred=noParticle;
+        ps.cellSucc=noParticle;
+        if (ps.lastPartner!=noParticle)
+            ps.lastPartner=newIndices[ps.lastPartner];
+        ps.inSortedCell=true;
+        newNextCollisions[i]=nextCollisions[order[i]];
+    }
+    positions.swap(newPositions);
+    velocities.swap(newVelocities);
+    timeStamps.swap(newTimeStamps);
+    particleStates.swap(newParticleStates);
+    nextCollisions.swap(newNextCollisions);
+    numUnsortedParticles=0;
+    if (!listCenters.empty())
+    {
+        std::vector<Point> newListCenters(numParticles);
+        std::vector<std::vector<ParticleIndex> > newNeighborLists(numParticles);
+        for (size_t i=0;i<numParticles;++i)
+        {
+            newListCenters[i]=listCenters[order[i]];
+            newNeighborLists[i].swap(neighborLists[order[i]]);
+        }
+        listCenters.swap(newListCenters);
+        neighborLists.swap(newNeighborLists);
+    }
+    
+    /* Renumber the particles in all queued and cached collisions and pending predictions: */
+    auto renumberParticle=[&newIndices](size_t particle) {
+        return size_t(newIndices[particle]);
+    };
+    auto renumberEvent=[&newIndices](CollisionEvent& e) {
+        if (e.getCollisionType()==CollisionEvent::ParticleCollision)
+        {
+            if (newIndices[e.partner]!=noParticle)
+                e.partner=newIndices[e.partner];
+            else
+                e.setPartnerRemoved();
+        }
+    };
+    collisionQueue.renumberHandles(renumberParticle);
+    collisionQueue.setNumHandles(numParticles);
+    collisionQueue.forEach(renumberEvent);
+    for (typename std::vector<CollisionEvent>::iterator ncIt=nextCollisions.begin();ncIt!=nextCollisions.end();++ncIt)
+        renumberEvent(*ncIt);
+    for (typename std::vector<ParticleIndex>::iterator ppIt=pendingParticles.begin();ppIt!=pendingParticles.end();++ppIt)
+        *ppIt=newIndices[*ppIt];
+    for (typename std::vector<std::vector<ParticleIndex> >::iterator nlIt=neighborLists.begin();nlIt!=neighborLists.end();++nlIt)
+        for (typename std::vector<ParticleIndex>::iterator nIt=nlIt->begin();nIt!=nlIt->end();++nIt)
+            *nIt=newIndices[*nIt];
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::invalidatePrediction(
+    typename CollisionBox<ScalarT, dimN>::ParticleIndex particle,
+    std::vector<typename CollisionBox<ScalarT, dimN>::ParticleIndex>& pending)
+{
+    /* Outdate all queued collisions involving the particle, and do not count its next collision as a repeat of its last one: */
+    ParticleState& ps=particleStates[particle];
+    ++ps.eventCounter;
+    ps.lastPartner=noParticle;
+    
+    /* Schedule the particle for re-prediction if the collision queue is kept between steps: */
+    if (persistentQueue && !ps.predictionPending)
+    {
+        ps.predictionPending=true;
+        pending.push_back(particle);
+    }
+}
+
+template <class ScalarT, int dimN>
+template <class FunctorParam>
+inline
+void
+CollisionBox<ScalarT, dimN>::runParallel(
+    size_t numItems,
+    FunctorParam& functor)
+{
+    /* Split the items into one contiguous range per thread: */
+    size_t numRanges=numThreads<1 ? 1 : size_t(numThreads);
+    if (numRanges>numItems)
+        numRanges=numItems;
+    if (numRanges<=1)
+    {
+        functor(0,0,numItems);
+        return;
+    }
+    
+    /* Process the first range in the calling thread, and the others in the pool's waiting worker threads: */
+    auto rangeFn=[&functor,numItems,numRanges](int i) {
+        functor(i,(numItems*size_t(i))/numRanges,(numItems*size_t(i+1))/numRanges);
+    };
+    workerPool.run(int(numRanges),rangeFn);
 }
 
 template <class ScalarT, int dimN>
@@ -192,72 +864,41 @@ CollisionBox<ScalarT, dimN>::CollisionBox(
     typename CollisionBox<ScalarT, dimN>::Scalar sParticleRadius,
     typename CollisionBox<ScalarT, dimN>::Scalar sSphereRadius)
     :boundaries(sBoundaries),
+     cellSizeFactor(1),autoCellSize(false),cellSizeTuned(false),
+     stencilRadius(1),
      numNeighbors(0),neighborOffsets(0),cellChangeMasks(0),
+     neighborSkin(0),
      particleRadius(sParticleRadius),particleRadius2(Math::sqr(particleRadius)),
      attenuation(1),
      numParticles(0),
+     numUnsortedParticles(0),
+     numRemovedParticles(0),reorderThreshold(Scalar(0.1)),
      spherePosition(Point::origin),
      sphereVelocity(Vector::zero),
      sphereRadius(sSphereRadius),sphereRadius2(Math::sqr(sphereRadius)),
      sphereTimeStamp(0),
+     sphereEventCounter(0),
      latentForce(0),
      boxFriction(0),
-     intraParticleGravitation(false)
+     intraParticleGravitation(false),
+     gravitationOpeningAngle(Scalar(0.5)),
+     persistentQueue(false),
+     queueInitialized(false),
+     sleepSpeed(0),sleepDelay(Scalar(0.5)),numSleepingParticles(0),
+     restitution(1),contactTime(Scalar(1.0e-3)),
+     stormThreshold(0),numRepeatedCollisions(0),
+     lastTimeStep(0),
+     predictionHorizon(0),
+     numThreads(1),
+     threadParticles(1)
 {
-    /* Calculate optimal number of cells and cell sizes: */
-    Index numOuterCells;
-    for (int i=0;i<dimension;++i)
-    {
-        numCells[i]=int(Math::floor(boundaries.getSize(i)/(particleRadius*Scalar(2))));
-        cellSize[i]=boundaries.getSize(i)/Scalar(numCells[i]);
-        numOuterCells[i]=numCells[i]+2; // Create a layer of "ghost cells" in all directions
-    }
-    
-    /* Create the cell array: */
-    cells.resize(numOuterCells);
-    for (Index index(0);index[0]<numOuterCells[0];cells.preInc(index))
-    {
-        /* Initialize the cell: */
-        Point min,max;
-        for (int i=0;i<dimension;++i)
-        {
-            min[i]=boundaries.min[i]+cellSize[i]*Scalar(index[i]-1);
-            max[i]=boundaries.min[i]+cellSize[i]*Scalar(index[i]-0);
-        }
-        cells(index).boundaries=Box(min,max);
-        cells(index).particlesHead=0;
-        cells(index).particlesTail=0;
-    }
-    
-    /* Initialize the direct neighbor offsets: */
-    for (int i=0;i<dimension;++i)
-    {
-        directNeighborOffsets[2*i+0]=-cells.getIncrement(i);
-        directNeighborOffsets[2*i+1]=cells.getIncrement(i);
-    }
+    /* Name the measured phases of simulate() in the order of StepRegion: */
+    static const char* stepRegionNames[]={"sorting","queueBuild","eventLoop","integration","gravity"};
+    for (int i=0;i<5;++i)
+        stepTimers.addRegion(stepRegionNames[i]);
     
-    /* Initialize the neighbor array: */
-    numNeighbors=1;
-    for (int i=0;i<dimension;++i)
-        numNeighbors*=3;
-    neighborOffsets=new ssize_t[numNeighbors];
-    cellChangeMasks=new int[numNeighbors];
-    Index minBound(-1);
-    Index maxBound(2);
-    int neighborIndex=0;
-    for (Index index=minBound;index[0]<maxBound[0];index.preInc(minBound,maxBound),++neighborIndex)
-    {
-        neighborOffsets[neighborIndex]=0;
-        cellChangeMasks[neighborIndex]=0x0;
-        for (int i=0;i<dimension;++i)
-        {
-            neighborOffsets[neighborIndex]+=cells.getIncrement(i)*index[i];
-            if (index[i]==-1)
-                cellChangeMasks[neighborIndex]|=1<<(2*i+0);
-            else if (index[i]==1)
-                cellChangeMasks[neighborIndex]|=1<<(2*i+1);
-        }
-    }
+    /* Create cells one particle diameter wide: */
+    createCells(cellSizeFactor);
     
     /* Position the spherical obstacle: */
     spherePosition[0]=boundaries.min[0]-sphereRadius-Scalar(10);
@@ -284,55 +925,240 @@ CollisionBox<ScalarT, dimN>::setAttenuation(
     attenuation=newAttenuation;
 }
 
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::Point
+CollisionBox<ScalarT, dimN>::clampToBox(
+    const typename CollisionBox<ScalarT, dimN>::Point& position) const
+{
+    Point result=position;
+    for (int i=0;i<dimension;++i)
+    {
+        if (result[i]<boundaries.min[i]+particleRadius)
+            result[i]=boundaries.min[i]+particleRadius;
+        else if (result[i]>boundaries.max[i]-particleRadius)
+            result[i]=boundaries.max[i]-particleRadius;
+    }
+    return result;
+}
+
+template <class ScalarT, int dimN>
+inline
+bool
+CollisionBox<ScalarT, dimN>::overlapsParticles(
+    const typename CollisionBox<ScalarT, dimN>::Point& position,
+    const typename CollisionBox<ScalarT, dimN>::Index& cell)
+{
+    bool overlaps=false;
+    auto checkOverlap=[this,&position,&overlaps](ParticleIndex p) {
+        if (Geometry::sqrDist(positions[p],position)<=Scalar(4)*particleRadius2)
+            overlaps=true;
+    };
+    for (int i=0;i<numNeighbors&&!overlaps;++i)
+        cells.getAddress(cell,neighborOffsets[i])->forEachParticle(particleStates.data(),checkOverlap);
+    return overlaps;
+}
+
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::ParticleIndex
+CollisionBox<ScalarT, dimN>::appendParticle(
+    const typename CollisionBox<ScalarT, dimN>::Point& newPosition,
+    const typename CollisionBox<ScalarT, dimN>::Vector& newVelocity,
+    const typename CollisionBox<ScalarT, dimN>::Index& cell)
+{
+    /* Add a new particle to the particle arrays: */
+    ParticleIndex p=ParticleIndex(numParticles);
+    positions.push_back(newPosition);
+    velocities.push_back(newVelocity);
+    timeStamps.push_back(Scalar(0));
+    particleStates.push_back(ParticleState(cell));
+    ParticleState& ps=particleStates.back();
+    nextCollisions.push_back(CollisionEvent(Scalar(0)));
+    if (neighborSkin>Scalar(0))
+    {
+        listCenters.push_back(newPosition);
+        neighborLists.push_back(std::vector<ParticleIndex>());
+    }
+    ++numParticles;
+    
+    /* Associate the particle with a free handle: */
+    if (!freeHandles.empty())
+    {
+        ps.handle=freeHandles.back();
+        freeHandles.pop_back();
+        handleIndices[ps.handle]=p;
+    }
+    else
+    {
+        ps.handle=ParticleHandle(handleIndices.size());
+        handleIndices.push_back(p);
+    }
+    
+    return p;
+}
+
 template <class ScalarT, int dimN>
 inline
 bool
 CollisionBox<ScalarT, dimN>::addParticle(
     const typename CollisionBox<ScalarT, dimN>::Point& newPosition,
-    const typename CollisionBox<ScalarT, dimN>::Vector& newVelocity)
+    const typename CollisionBox<ScalarT, dimN>::Vector& newVelocity,
+    typename CollisionBox<ScalarT, dimN>::ParticleHandle* newHandle)
 {
-    /* Find the cell containing the new particle: */
-    Point newP=newPosition;
-    Index cellIndex;
-    for (int i=0;i<dimension;++i)
+    /* Check if there is room to add the new particle in the cell containing it: */
+    Point newP=clampToBox(newPosition);
+    Index cellIndex=calcCellIndex(newP);
+    if (overlapsParticles(newP,cellIndex))
+        return false; // Could not add the particle
+    
+    /* Add a new particle to the particle arrays and its grid cell: */
+    ParticleIndex p=appendParticle(newPosition,newVelocity,cellIndex);
+    if (newHandle!=0)
+        *newHandle=particleStates[p].handle;
+    cells.getAddress(cellIndex)->addParticle(p,&particleStates[0]);
+    ++numUnsortedParticles;
+    collisionQueue.setNumHandles(numParticles);
+    
+    /* Link the new particle to its neighbors: */
+    if (neighborSkin>Scalar(0))
+        buildNeighborList(p,true);
+    
+    /* Predict the new particle's collisions at the beginning of the next step: */
+    if (persistentQueue)
+        schedulePrediction(p);
+    
+    return true; // Particle succesfully added
+}
+
+template <class ScalarT, int dimN>
+inline
+size_t
+CollisionBox<ScalarT, dimN>::addParticles(
+    const std::vector<typename CollisionBox<ScalarT, dimN>::Point>& newPositions,
+    const std::vector<typename CollisionBox<ScalarT, dimN>::Vector>& newVelocities,
+    std::vector<typename CollisionBox<ScalarT, dimN>::ParticleHandle>* newHandles)
+{
+    if (newVelocities.size()!=newPositions.size())
+        throw std::runtime_error("CollisionBox::addParticles: Number of velocities does not match number of positions");
+    
+    /* Append the entire batch to the particle arrays, and grow the handle and queue arrays once: */
+    size_t batchSize=newPositions.size();
+    positions.reserve(numParticles+batchSize);
+    velocities.reserve(numParticles+batchSize);
+    timeStamps.reserve(numParticles+batchSize);
+    particleStates.reserve(numParticles+batchSize);
+    nextCollisions.reserve(numParticles+batchSize);
+    if (neighborSkin>Scalar(0))
+    {
+        listCenters.reserve(numParticles+batchSize);
+        neighborLists.reserve(numParticles+batchSize);
+    }
+    if (batchSize>freeHandles.size())
+        handleIndices.reserve(handleIndices.size()+batchSize-freeHandles.size());
+    std::vector<ParticleHandle> batchHandles(batchSize);
+    for (size_t i=0;i<batchSize;++i)
     {
-        if (newP[i]<boundaries.min[i]+particleRadius)
-            newP[i]=boundaries.min[i]+particleRadius;
-        else if (newP[i]>boundaries.max[i]-particleRadius)
-            newP[i]=boundaries.max[i]-particleRadius;
-        cellIndex[i]=int(Math::floor((newP[i]-boundaries.min[i])/cellSize[i]))+1;
+        ParticleIndex p=appendParticle(newPositions[i],newVelocities[i],calcCellIndex(clampToBox(newPositions[i])));
+        batchHandles[i]=particleStates[p].handle;
     }
-    GridCell* cell=cells.getAddress(cellIndex);
+    collisionQueue.setNumHandles(numParticles);
     
-    /* Check if there is room to add the new particle: */
-    for (int i=0;i<numNeighbors;++i)
+    /* Sort all particles into contiguous cell ranges in one pass, and hide the new particles from the overlap checks: */
+    sortParticles();
+    for (size_t i=0;i<batchSize;++i)
+        particleStates[handleIndices[batchHandles[i]]].inSortedCell=false;
+    
+    /* Check the new particles in batch order against the old particles and the new ones accepted before them: */
+    if (newHandles!=0)
+        newHandles->assign(batchSize,ParticleHandle(noHandle));
+    size_t numAdded=0;
+    for (size_t i=0;i<batchSize;++i)
     {
-        GridCell* neighborCell=cell+neighborOffsets[i];
-        
-        for (Particle* pPtr=neighborCell->particlesHead;pPtr!=0;pPtr=pPtr->cellSucc)
+        ParticleIndex p=handleIndices[batchHandles[i]];
+        ParticleState& ps=particleStates[p];
+        if (overlapsParticles(clampToBox(positions[p]),ps.cell))
         {
-            Scalar dist2=Geometry::sqrDist(pPtr->position,newP);
-            if (dist2<=Scalar(2)*particleRadius2)
-                return false; // Could not add the particle
+            /* Release the particle's handle; its array slot stays empty until the next reordering: */
+            handleIndices[ps.handle]=noParticle;
+            freeHandles.push_back(ps.handle);
+            ps.handle=noHandle;
+            ++numRemovedParticles;
+            continue;
         }
+        
+        /* Accept the particle, link it to its neighbors, and predict its collisions at the beginning of the next step: */
+        ps.inSortedCell=true;
+        if (neighborSkin>Scalar(0))
+            buildNeighborList(p,true);
+        if (persistentQueue)
+            schedulePrediction(p);
+        if (newHandles!=0)
+            (*newHandles)[i]=ps.handle;
+        ++numAdded;
     }
-    /* Add a new particle to the particle list: */
-    particles.push_back(Particle());
-    Particle& p=particles.back();
     
-    /* Initialize the new particle: */
-    p.position=newPosition;
-    p.velocity=newVelocity;
-    p.timeStamp=Scalar(0);
-    cell->addParticle(&p);
+    return numAdded;
+}
 
-    for (typename ParticleList::iterator i = particles.begin(); i != particles.end() && &(*i) != &p; ++i) {
-        if (&(*i) != &p) {
-            particlePairs.push_back(ParticlePair(&p, &(*i)));
-        }
+template <class ScalarT, int dimN>
+inline
+bool
+CollisionBox<ScalarT, dimN>::removeParticle(
+    typename CollisionBox<ScalarT, dimN>::ParticleHandle handle)
+{
+    if (handle>=handleIndices.size() || handleIndices[handle]==noParticle)
+        return false; // No particle associated with the handle
+    
+    /* Release the particle's handle: */
+    ParticleIndex p=handleIndices[handle];
+    handleIndices[handle]=noParticle;
+    freeHandles.push_back(handle);
+    
+    /* Remove the particle from its grid cell; its array slot stays empty until the next reordering: */
+    ParticleState& ps=particleStates[p];
+    if (ps.inSortedCell)
+        ps.inSortedCell=false;
+    else
+        cells.getAddress(ps.cell)->removeParticle(p,&particleStates[0]);
+    ps.handle=noHandle;
+    ++numRemovedParticles;
+    if (ps.asleep)
+    {
+        ps.asleep=false;
+        --numSleepingParticles;
+    }
+    if (numSleepingParticles>0)
+    {
+        /* Wake the parked particles that might have rested on the particle: */
+        Scalar contactDistance2=Math::sqr(particleRadius*Scalar(2.1));
+        auto wakeFn=[this,p,contactDistance2](ParticleIndex neighbor) {
+            if (neighbor!=p && particleStates[neighbor].asleep && Geometry::sqrDist(positions[neighbor],positions[p])<=contactDistance2)
+                wakeParticle(neighbor);
+        };
+        forEachNeighbor(p,wakeFn);
+    }
+    if (neighborSkin>Scalar(0))
+    {
+        unlinkNeighbors(p);
+        neighborLists[p].clear();
     }
     
-    return true; // Particle succesfully added
+    /* Outdate all collisions predicted with the particle, and drop its own: */
+    ++ps.eventCounter;
+    if (collisionQueue.contains(p))
+        collisionQueue.remove(p);
+    if (ps.predictionPending)
+    {
+        /* Move the last particle in the list of particles to re-predict into the removed particle's place: */
+        ParticleIndex last=pendingParticles.back();
+        pendingParticles[ps.pendingPosition]=last;
+        particleStates[last].pendingPosition=ps.pendingPosition;
+        pendingParticles.pop_back();
+        ps.predictionPending=false;
+    }
+    
+    return true; // Particle successfully removed
 }
 
 template <class ScalarT, int dimN>
@@ -344,130 +1170,617 @@ CollisionBox<ScalarT, dimN>::moveSphere(
 {
     /* Calculate the sphere's velocity for this time step: */
     sphereVelocity=(newPosition-spherePosition)/timeStep;
+    ++sphereEventCounter;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setPersistentQueue(
+    bool enable)
+{
+    if (persistentQueue!=enable)
+    {
+        persistentQueue=enable;
+        
+        /* Rebuild the collision queue from scratch on the next step: */
+        queueInitialized=false;
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setCellLayout(
+    typename CollisionBox<ScalarT, dimN>::CellLayout newCellLayout)
+{
+    /* Re-create the cell array in the new layout and sort all particles into it along the new cell order: */
+    cells.resize(cells.getSize(),newCellLayout==MortonCells ? CellArray::Morton : CellArray::RowMajor);
+    sortedCells.clear();
+    sortParticles();
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setCellSizeFactor(
+    typename CollisionBox<ScalarT, dimN>::Scalar newCellSizeFactor)
+{
+    /* Re-create the cell array and sort all particles into the cells containing their current positions: */
+    createCells(newCellSizeFactor);
+    rebuildCells();
+    
+    /* Queued cell changes refer to the old cells; rebuild the collision queue from scratch on the next step: */
+    queueInitialized=false;
+}
+
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::Scalar
+CollisionBox<ScalarT, dimN>::tuneCellSize(
+    void)
+{
+    Scalar newCellSizeFactor=findCellSizeFactor();
+    if (newCellSizeFactor!=cellSizeFactor)
+        setCellSizeFactor(newCellSizeFactor);
+    
+    return cellSizeFactor;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setNeighborSkin(
+    typename CollisionBox<ScalarT, dimN>::Scalar newNeighborSkin)
+{
+    /* Widen the neighbor stencil to the new range and build all neighbor lists around the particles' current positions: */
+    neighborSkin=newNeighborSkin>Scalar(0) ? newNeighborSkin : Scalar(0);
+    createCells(cellSizeFactor);
+    rebuildCells();
+    
+    /* Rebuild the collision queue from scratch on the next step: */
+    queueInitialized=false;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setSleeping(
+    typename CollisionBox<ScalarT, dimN>::Scalar newSleepSpeed,
+    typename CollisionBox<ScalarT, dimN>::Scalar newSleepDelay)
+{
+    sleepSpeed=newSleepSpeed>Scalar(0) ? newSleepSpeed : Scalar(0);
+    sleepDelay=newSleepDelay;
+    
+    /* Wake all parked particles if sleeping was disabled: */
+    if (sleepSpeed==Scalar(0) && numSleepingParticles>0)
+    {
+        for (size_t i=0;i<numParticles;++i)
+            if (particleStates[i].asleep)
+                wakeParticle(ParticleIndex(i));
+    }
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setRestitution(
+    typename CollisionBox<ScalarT, dimN>::Scalar newRestitution,
+    typename CollisionBox<ScalarT, dimN>::Scalar newContactTime)
+{
+    restitution=newRestitution<Scalar(0) ? Scalar(0) : (newRestitution>Scalar(1) ? Scalar(1) : newRestitution);
+    contactTime=newContactTime;
+    
+    /* Forget all collision times, which are not tracked while collisions are elastic: */
+    for (size_t i=0;i<numParticles;++i)
+        particleStates[i].lastImpactTime=-Math::Constants<Scalar>::max;
+}
+
+template <class ScalarT, int dimN>
+inline
+void
+CollisionBox<ScalarT, dimN>::setQueueType(
+    typename CollisionBox<ScalarT, dimN>::QueueType newQueueType)
+{
+    if (getQueueType()!=newQueueType)
+    {
+        collisionQueue.setImplementation(typename CollisionQueue::Implementation(newQueueType),numParticles);
+        
+        /* Rebuild the collision queue from scratch on the next step: */
+        queueInitialized=false;
+    }
 }
 
 template <class ScalarT, int dimN>
 inline
 void
+CollisionBox<ScalarT, dimN>::setNumThreads(
+    int newNumThreads)
+{
+    /* Use all hardware threads if no number is given: */
+    if (newNumThreads<1)
+        newNumThreads=int(std::thread::hardware_concurrency());
+    numThreads=newNumThreads>1 ? newNumThreads : 1;
+    threadParticles.resize(numThreads);
+    
+    /* Keep one waiting worker thread for each thread beyond the calling one: */
+    if (workerPool.getNumWorkers()!=numThreads-1)
+        workerPool.setNumWorkers(numThreads-1);
+}
+
+template <class ScalarT, int dimN>
+inline
+typename CollisionBox<ScalarT, dimN>::Scalar
 CollisionBox<ScalarT, dimN>::simulate(
-    typename CollisionBox<ScalarT, dimN>::Scalar timeStep)
+    typename CollisionBox<ScalarT, dimN>::Scalar timeStep,
+    size_t maxEvents,
+    double maxSeconds)
 {
-    /* Initialize the collision queue: */
-    CollisionQueue collisionQueue(numParticles*dimension);
-    for (typename ParticleList::iterator pIt=particles.begin();pIt!=particles.end();++pIt)
-        queueCollisions(&(*pIt),timeStep,false,0,collisionQueue);
+    Misc::Timer deadlineTimer;
+    
+    /* Sort the particles by grid cell if too many of them are scattered over the cells' lists of moved particles, or if removed particles left empty slots: */
+    bool sortNeeded=numRemovedParticles>0 || (numUnsortedParticles>0 && Scalar(numUnsortedParticles)>=reorderThreshold*Scalar(numParticles));
+    lastTimeStep=timeStep;
+    
+    /* Pick the cell size from the last step's statistics before they are reset; re-creating the grid sorts the particles as well: */
+    if (autoCellSize && (!cellSizeTuned || sortNeeded))
+    {
+        Misc::RegionTimers::Scope timerScope(stepTimers,SortingRegion);
+        Scalar oldCellSizeFactor=cellSizeFactor;
+        if (tuneCellSize()!=oldCellSizeFactor)
+            sortNeeded=false;
+        cellSizeTuned=true;
+    }
+    
+    stepStats=SimulationStats();
+    numRepeatedCollisions=0;
+    
+    if (sortNeeded)
+    {
+        Misc::RegionTimers::Scope timerScope(stepTimers,SortingRegion);
+        sortParticles();
+    }
+    
+    /* Wake the parked particles in the way of the spherical obstacle: */
+    if (numSleepingParticles>0)
+    {
+        Misc::RegionTimers::Scope timerScope(stepTimers,QueueBuildRegion);
+        wakeSphereContacts(timeStep);
+    }
+    
+    /* Rebuilding the queue is cheaper than re-predicting most particles on top of outdated collisions: */
+    if (persistentQueue && pendingParticles.size()*2>numParticles)
+        queueInitialized=false;
+
     
-    /* Update all particles' positions and handle all collisions: */
-    while (!collisionQueue.isEmpty())
     {
-        /* Get the next collision from the queue: */
-        CollisionEvent nc=collisionQueue.getSmallest();
-        collisionQueue.removeSmallest();
+        Misc::RegionTimers::Scope timerScope(stepTimers,QueueBuildRegion);
+        /* Keep room for one event per particle, so that the queue never grows while a step is simulated: */
+        collisionQueue.reserve(numParticles);
         
-        /* Handle the collision if it is still valid: */
-        switch (nc.collisionType)
+        /* Spread a calendar queue's buckets over this step; events queued during earlier steps were rebased to its start: */
+        collisionQueue.setWindow(0.0,double(timeStep));
+        
+        if (!persistentQueue || !queueInitialized)
         {
-            case CollisionEvent::CellChange:
-                if (nc.particle1->timeStamp==nc.timeStamp1)
-                {
-                    /* Let the particle cross into the next grid cell: */
-                    GridCell* cell=nc.particle1->cell;
-                    cell->removeParticle(nc.particle1);
-                    cell+=directNeighborOffsets[nc.cellChangeDirection];
-                    cell->addParticle(nc.particle1);
-                    
-                    /* Re-calculate all the particle's collisions: */
-                    queueCollisionsOnCellChange(nc.particle1,timeStep,nc.cellChangeDirection,collisionQueue);
+            /* Predict all collisions up to the end of this step, or indefinitely if the queue is kept: */
+            predictionHorizon=persistentQueue ? Math::Constants<Scalar>::max : timeStep;
+        
+            /* Predict all active particles' collisions in parallel: */
+            collisionQueue.clear();
+            auto predictFn=[this,timeStep](int, size_t begin, size_t end) {
+                for (size_t i=begin;i<end;++i) {
+                    particleStates[i].predictionPending=false;
+                    if (!particleStates[i].asleep)
+                        predictCollisions(ParticleIndex(i),timeStep,false,noParticle);
                 }
-                break;
-            
-            case CollisionEvent::WallCollision:
-                if (nc.particle1->timeStamp==nc.timeStamp1)
-                {
-                    /* Bounce the particle off the wall: */
-                    nc.particle1->position+=nc.particle1->velocity*(nc.collisionTime-nc.timeStamp1);
-                    nc.particle1->timeStamp=nc.collisionTime;
-                    Vector dv=(Scalar(2)*(nc.wallNormal*nc.particle1->velocity))*nc.wallNormal;
-                    nc.particle1->velocity-=dv;
-                    
-                    /* Re-calculate all the particle's collisions: */
-                    queueCollisions(nc.particle1,timeStep,true,0,collisionQueue);
+            };
+            runParallel(numParticles,predictFn);
+            for (size_t i=0;i<numParticles;++i)
+                if (!particleStates[i].asleep)
+                    queueNextEvent(ParticleIndex(i));
+            pendingParticles.clear();
+            queueInitialized=persistentQueue;
+        }
+        else
+        {
+            /* Check all particles whose predictions are still valid for collisions with the moved spherical obstacle: */
+            auto sphereFn=[this,timeStep](int threadIndex, size_t begin, size_t end) {
+                for (size_t i=begin;i<end;++i) {
+                    if (!particleStates[i].predictionPending && !particleStates[i].asleep) {
+                        CollisionEvent& nextCollision=nextCollisions[i];
+                        findSphereCollision(ParticleIndex(i),timeStep,nextCollision);
+                        if (nextCollision.getCollisionType()==CollisionEvent::SphereCollision)
+                            threadParticles[threadIndex].push_back(ParticleIndex(i));
+                    }
+                }
+            };
+            runParallel(numParticles,sphereFn);
+        
+            /* Re-predict all collisions of particles whose velocities changed outside of collisions: */
+            auto repredictFn=[this,timeStep](int threadIndex, size_t begin, size_t end) {
+                for (size_t i=begin;i<end;++i) {
+                    ParticleIndex p=pendingParticles[i];
+                    particleStates[p].predictionPending=false;
+                    if (!particleStates[p].asleep) {
+                        predictCollisions(p,timeStep,true,noParticle);
+                        threadParticles[threadIndex].push_back(p);
+                    }
                 }
+            };
+            runParallel(pendingParticles.size(),repredictFn);
+            pendingParticles.clear();
+        
+            /* Queue the new predictions: */
+            for (typename std::vector<std::vector<ParticleIndex> >::iterator tpIt=threadParticles.begin();tpIt!=threadParticles.end();++tpIt)
+            {
+                for (typename std::vector<ParticleIndex>::iterator pIt=tpIt->begin();pIt!=tpIt->end();++pIt)
+                    queueNextEvent(*pIt);
+                tpIt->clear();
+            }
+        }
+    }
+    
+    Scalar stepTime=timeStep; // Time up to which the step's events were handled
+    {
+        Misc::RegionTimers::Scope timerScope(stepTimers,EventLoopRegion);
+        /* Update all particles' positions and handle all collisions up to the end of this step: */
+        size_t numHandledEvents=0;
+        size_t nextDeadlineCheck=0; // Number of handled events after which the deadline is checked again
+        Scalar lastEventTime(0); // Time of the last handled event
+        Scalar stormInterval=timeStep*Scalar(1.0e-6); // Longest time between two collisions of the same particles that counts them as repeated
+        while (!collisionQueue.isEmpty() && collisionQueue.getSmallest().collisionTime<=timeStep)
+        {
+            /* Get the next collision from the queue; it stays queued until its particle's collisions are re-predicted: */
+            CollisionEvent nc=collisionQueue.getSmallest();
+            ParticleIndex p1=ParticleIndex(collisionQueue.getSmallestHandle());
+            
+            /* Read the clock at the first non-simultaneous event at least 64 events after the last reading, which keeps its cost negligible: */
+            bool outOfTime=false;
+            if (maxSeconds>0.0 && numHandledEvents>=nextDeadlineCheck && nc.collisionTime>lastEventTime)
+            {
+                outOfTime=deadlineTimer.peekTime()>=maxSeconds;
+                nextDeadlineCheck=numHandledEvents+64;
+            }
+            
+            /* End the step early if the event budget or the deadline ran out, or an event storm was detected: */
+            if (nc.collisionTime>lastEventTime &&
+               ((maxEvents!=0 && numHandledEvents>=maxEvents) || outOfTime ||
+                (stormThreshold!=0 && numRepeatedCollisions>=stormThreshold)))
+            {
+                /* Stop halfway to the next event, where no two particles touch while approaching each other; simultaneous events are never split: */
+                stepTime=Math::mid(lastEventTime,nc.collisionTime);
                 break;
+            }
+            ++numHandledEvents;
+            if (lastEventTime<nc.collisionTime)
+                lastEventTime=nc.collisionTime;
             
-            case CollisionEvent::SphereCollision:
-                if (nc.particle1->timeStamp==nc.timeStamp1 && sphereTimeStamp==nc.timeStamp2)
-                {
-                    /* Bounce the two particles off each other: */
-                    nc.particle1->position+=nc.particle1->velocity*(nc.collisionTime-nc.timeStamp1);
-                    nc.particle1->timeStamp=nc.collisionTime;
-                    Point sp=spherePosition+sphereVelocity*(nc.collisionTime-nc.timeStamp2);
-                    Vector d=sp-nc.particle1->position;
-                    Scalar dLen2=Geometry::sqr(d);
-                    Vector v1=d*((nc.particle1->velocity*d)/dLen2);
-                    Vector v2=d*((sphereVelocity*d)/dLen2);
-                    nc.particle1->velocity+=Scalar(2)*(v2-v1);
+            /* Handle the collision: */
+            switch (nc.getCollisionType())
+            {
+                case CollisionEvent::CellChange:
+                    {
+                        /* Let the particle cross into the next grid cell: */
+                        Index newCell=particleStates[p1].cell;
+                        if (nc.getBorderIndex()&0x1)
+                            ++newCell[nc.getBorderIndex()>>1];
+                        else
+                            --newCell[nc.getBorderIndex()>>1];
+                        moveToCell(p1,newCell);
+                        
+                        /* Check for collisions with the particles in the new neighbor cells: */
+                        queueCollisionsOnCellChange(p1,nc.getBorderIndex());
+                        if (collectStats)
+                            ++stepStats.numCellChanges;
+                    }
+                    break;
+                
+                case CollisionEvent::NeighborListUpdate:
+                    {
+                        /* Center the particle's neighbor list at its current position, and move it into the grid cell containing that position: */
+                        listCenters[p1]=positions[p1]+velocities[p1]*(nc.collisionTime-timeStamps[p1]);
+                        Index newCell=calcCellIndex(listCenters[p1]);
+                        if (newCell!=particleStates[p1].cell)
+                            moveToCell(p1,newCell);
+                        
+                        /* Replace the particle's neighbor list: */
+                        unlinkNeighbors(p1);
+                        oldNeighbors.swap(neighborLists[p1]);
+                        neighborLists[p1].clear();
+                        buildNeighborList(p1,true);
+                        
+                        /* Check for collisions with the particles that just became neighbors: */
+                        std::sort(oldNeighbors.begin(),oldNeighbors.end());
+                        CollisionEvent& nextCollision=nextCollisions[p1];
+                        const std::vector<ParticleIndex>& neighbors=neighborLists[p1];
+                        for (typename std::vector<ParticleIndex>::const_iterator nIt=neighbors.begin();nIt!=neighbors.end();++nIt)
+                            if (!std::binary_search(oldNeighbors.begin(),oldNeighbors.end(),*nIt))
+                                findParticleCollision(p1,*nIt,nextCollision);
+                        queueNextEvent(p1);
+                        if (collectStats)
+                            ++stepStats.numListUpdates;
+                    }
+                    break;
+                
+                case CollisionEvent::WallCollision:
+                    {
+                        /* Bounce the particle off the wall: */
+                        positions[p1]+=velocities[p1]*(nc.collisionTime-timeStamps[p1]);
+                        timeStamps[p1]=nc.collisionTime;
+                        int axis=nc.getBorderIndex()>>1;
+                        ParticleState& ps=particleStates[p1];
+                        if (restitution<Scalar(1))
+                        {
+                            /* Lose energy unless the particle collided less than the contact time ago: */
+                            velocities[p1][axis]*=nc.collisionTime-ps.lastImpactTime>=contactTime ? -restitution : Scalar(-1);
+                            ps.lastImpactTime=nc.collisionTime;
+                        }
+                        else
+                            velocities[p1][axis]=-velocities[p1][axis];
+                        ++ps.eventCounter;
+                        
+                        /* Re-calculate all the particle's collisions: */
+                        queueCollisions(p1,timeStep,true,noParticle);
+                        if (collectStats)
+                            ++stepStats.numWallCollisions;
+                    }
+                    break;
+                
+                case CollisionEvent::SphereCollision:
+                    if (sphereEventCounter==nc.payload)
+                    {
+                        /* Bounce the two particles off each other: */
+                        positions[p1]+=velocities[p1]*(nc.collisionTime-timeStamps[p1]);
+                        timeStamps[p1]=nc.collisionTime;
+                        Point sp=spherePosition+sphereVelocity*(nc.collisionTime-sphereTimeStamp);
+                        Vector d=sp-positions[p1];
+                        Scalar dLen2=Geometry::sqr(d);
+                        Vector v1=d*((velocities[p1]*d)/dLen2);
+                        Vector v2=d*((sphereVelocity*d)/dLen2);
+                        velocities[p1]+=Scalar(2)*(v2-v1);
+                        ++particleStates[p1].eventCounter;
+                        if (numSleepingParticles>0)
+                            wakeContacts(p1,nc.collisionTime,timeStep);
+                        if (collectStats)
+                            ++stepStats.numSphereCollisions;
+                    }
+                    else if (collectStats)
+                        ++stepStats.numOutdatedEvents;
                     
                     /* Re-calculate all collisions of the particle: */
-                    queueCollisions(nc.particle1,timeStep,true,0,collisionQueue);
+                    queueCollisions(p1,timeStep,true,noParticle);
+                    break;
+                
+                case CollisionEvent::ParticleCollision:
+                    {
+                        ParticleIndex p2=nc.partner;
+                        if (particleStates[p2].eventCounter==nc.payload)
+                        {
+                            /* Count the collision as repeated if the two particles collided with each other a vanishing time before, which signals an event storm: */
+                            ParticleState& ps1=particleStates[p1];
+                            ParticleState& ps2=particleStates[p2];
+                            if (ps1.lastPartner==p2 && ps2.lastPartner==p1 && ps1.lastCollisionTime==ps2.lastCollisionTime && nc.collisionTime>=ps1.lastCollisionTime && nc.collisionTime-ps1.lastCollisionTime<=stormInterval)
+                            {
+                                ++numRepeatedCollisions;
+                                if (collectStats)
+                                    ++stepStats.numRepeatedCollisions;
+                            }
+                            ps1.lastPartner=p2;
+                            ps1.lastCollisionTime=nc.collisionTime;
+                            ps2.lastPartner=p1;
+                            ps2.lastCollisionTime=nc.collisionTime;
+                            
+                            /* Wake the second particle if it was parked: */
+                            if (ps2.asleep)
+                            {
+                                ps2.asleep=false;
+                                ps2.restTime=Scalar(0);
+                                --numSleepingParticles;
+                            }
+                            
+                            /* Bounce the two particles off each other: */
+                            positions[p1]+=velocities[p1]*(nc.collisionTime-timeStamps[p1]);
+                            timeStamps[p1]=nc.collisionTime;
+                            positions[p2]+=velocities[p2]*(nc.collisionTime-timeStamps[p2]);
+                            timeStamps[p2]=nc.collisionTime;
+                            Vector d=positions[p2]-positions[p1];
+                            Scalar dLen2=Geometry::sqr(d);
+                            Vector v1=d*((velocities[p1]*d)/dLen2);
+                            Vector v2=d*((velocities[p2]*d)/dLen2);
+                            Vector dv=v2-v1;
+                            if (restitution<Scalar(1))
+                            {
+                                /* Exchange only part of the normal velocities unless either particle collided less than the contact time ago, as in the TC model, so that clusters cannot collapse inelastically: */
+                                if (nc.collisionTime-ps1.lastImpactTime>=contactTime && nc.collisionTime-ps2.lastImpactTime>=contactTime)
+                                    dv*=Math::div2(Scalar(1)+restitution);
+                                ps1.lastImpactTime=nc.collisionTime;
+                                ps2.lastImpactTime=nc.collisionTime;
+                            }
+                            velocities[p1]+=dv;
+                            velocities[p2]-=dv;
+                            ++ps1.eventCounter;
+                            ++ps2.eventCounter;
+                            
+                            /* Re-calculate all collisions of both particles: */
+                            queueCollisions(p1,timeStep,true,p2);
+                            queueCollisions(p2,timeStep,true,p1);
+                            
+                            /* Wake the parked particles that might have rested on either particle: */
+                            if (numSleepingParticles>0)
+                            {
+                                wakeContacts(p1,nc.collisionTime,timeStep);
+                                wakeContacts(p2,nc.collisionTime,timeStep);
+                            }
+                            if (collectStats)
+                                ++stepStats.numParticleCollisions;
+                        }
+                        else
+                        {
+                            /* The other particle changed course since the collision was predicted; re-calculate all collisions of the particle: */
+                            queueCollisions(p1,timeStep,true,noParticle);
+                            if (collectStats)
+                                ++stepStats.numOutdatedEvents;
+                        }
+                    }
+                    break;
+                
+                case CollisionEvent::PartnerRemoved:
+                    /* The other particle was removed since the collision was predicted; re-calculate all collisions of the particle: */
+                    queueCollisions(p1,timeStep,true,noParticle);
+                    if (collectStats)
+                        ++stepStats.numOutdatedEvents;
+                    break;
+                
+                case CollisionEvent::NoCollision:
+                    break;
+            }
+        }
+    }
+    
+    {
+        Misc::RegionTimers::Scope timerScope(stepTimers,IntegrationRegion);
+        // Scale attenuation factor for this time step
+        Scalar att = (attenuation != Scalar(1) ? Math::pow(attenuation, stepTime) : Scalar(1));
+        
+        /* Apply the fraction of the per-step force and friction that corresponds to the simulated part of a step that stopped early: */
+        Vector stepForce = latentForce;
+        Scalar stepFriction = boxFriction;
+        if (stepTime < timeStep) {
+            Scalar stepFraction = stepTime/timeStep;
+            stepForce *= stepFraction;
+            stepFriction *= stepFraction;
+        }
+        
+        /* Update all particles to the end of the timestep and apply any passive or active forces acting on them: */
+        static_assert(sizeof(Point) == dimension*sizeof(Scalar) && sizeof(Vector) == dimension*sizeof(Scalar), "Points and vectors must be stored as packed components");
+        bool velocitiesChange = att != Scalar(1) || stepForce != Vector::zero || stepFriction != Scalar(0);
+        auto updateFn = [this, att, stepTime, &stepForce, stepFriction, velocitiesChange](int threadIndex, size_t begin, size_t end) {
+            /* Process the particles in blocks that stay in cache between the fused kernel and the check for changed velocities: */
+            const size_t blockSize = 256;
+            Vector oldVelocities[blockSize];
+            for (size_t blockBegin = begin; blockBegin < end; ) {
+                /* Skip parked particles, which stay at rest until woken: */
+                if (numSleepingParticles > 0) {
+                    while (blockBegin < end && particleStates[blockBegin].asleep) {
+                        ++blockBegin;
+                    }
+                    if (blockBegin == end) {
+                        break;
+                    }
                 }
-                break;
-            
-            case CollisionEvent::ParticleCollision:
-                if (nc.particle1->timeStamp==nc.timeStamp1 && nc.particle2->timeStamp==nc.timeStamp2)
-                {
-                    /* Bounce the two particles off each other: */
-                    nc.particle1->position+=nc.particle1->velocity*(nc.collisionTime-nc.timeStamp1);
-                    nc.particle1->timeStamp=nc.collisionTime;
-                    nc.particle2->position+=nc.particle2->velocity*(nc.collisionTime-nc.timeStamp2);
-                    nc.particle2->timeStamp=nc.collisionTime;
-                    Vector d=nc.particle2->position-nc.particle1->position;
-                    Scalar dLen2=Geometry::sqr(d);
-                    Vector v1=d*((nc.particle1->velocity*d)/dLen2);
-                    Vector v2=d*((nc.particle2->velocity*d)/dLen2);
-                    Vector dv=v2-v1;
-                    nc.particle1->velocity+=dv;
-                    nc.particle2->velocity-=dv;
-                    
-                    /* Re-calculate all collisions of both particles: */
-                    queueCollisions(nc.particle1,timeStep,true,nc.particle2,collisionQueue);
-                    queueCollisions(nc.particle2,timeStep,true,nc.particle1,collisionQueue);
+                
+                /* Advance the next block of active particles: */
+                size_t blockEnd = blockBegin+blockSize < end ? blockBegin+blockSize : end;
+                if (numSleepingParticles > 0) {
+                    for (size_t i = blockBegin+1; i < blockEnd; ++i) {
+                        if (particleStates[i].asleep) {
+                            blockEnd = i;
+                            break;
+                        }
+                    }
                 }
-                break;
+                if (velocitiesChange) {
+                    std::copy(velocities.begin()+blockBegin, velocities.begin()+blockEnd, oldVelocities);
+                }
+                ParticleKernels::advance<Scalar, dimension>(blockEnd-blockBegin,
+                                                           positions[blockBegin].getComponents(),
+                                                           velocities[blockBegin].getComponents(),
+                                                           &timeStamps[blockBegin],
+                                                           stepTime, att, stepForce.getComponents(), stepFriction);
+                if (velocitiesChange) {
+                    for (size_t i = blockBegin; i < blockEnd; ++i) {
+                        if (velocities[i] != oldVelocities[i-blockBegin]) {
+                            invalidatePrediction(ParticleIndex(i), threadParticles[threadIndex]);
+                        }
+                    }
+                }
+                for (size_t i = blockBegin; i < blockEnd; ++i) {
+                    /* Move the last collision times into the time frame of the next step: */
+                    particleStates[i].lastCollisionTime -= stepTime;
+                    particleStates[i].lastImpactTime -= stepTime;
+                }
+                blockBegin = blockEnd;
+            }
+        };
+        runParallel(numParticles, updateFn);
+    }
+
+    if (intraParticleGravitation) {
+        Misc::RegionTimers::Scope timerScope(stepTimers,GravityRegion);
+        
+        /* Build a tree of all particles' end-of-step positions: */
+        gravityTree.clear(boundaries);
+        for (size_t i = 0; i < numParticles; ++i) {
+            gravityTree.insert(positions[i], Scalar(1));
         }
+        
+        /* Pull each particle towards all others, approximating distant groups by their centers of mass: */
+        auto particlePull = [this](int threadIndex, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (particleStates[i].asleep) {
+                    continue;
+                }
+                Vector pull = gravityTree.calcAcceleration(positions[i], gravitationOpeningAngle);
+                if (pull != Vector::zero) {
+                    velocities[i] += pull;
+                    invalidatePrediction(ParticleIndex(i), threadParticles[threadIndex]);
+                }
+            }
+        };
+        runParallel(numParticles, particlePull);
     }
     
-    // Scale attenuation factor for this time step
-    Scalar att = (attenuation != Scalar(1) ? Math::pow(attenuation, timeStep) : Scalar(1));
+    /* Collect the particles whose trajectories changed: */
+    for (typename std::vector<std::vector<ParticleIndex> >::iterator tpIt=threadParticles.begin();tpIt!=threadParticles.end();++tpIt)
+    {
+        for (typename std::vector<ParticleIndex>::iterator pIt=tpIt->begin();pIt!=tpIt->end();++pIt)
+        {
+            particleStates[*pIt].pendingPosition=(unsigned int)(pendingParticles.size());
+            pendingParticles.push_back(*pIt);
+        }
+        tpIt->clear();
+    }
     
-    /* Update all particles to the end of the timestep: */
-    auto updateFn = [this, att, timeStep](Particle& p) {
-        p.position += p.velocity * (timeStep - p.timeStamp);
-        p.velocity *= att;
-        p.timeStamp = Scalar(0);
-    };
-    particles.forEach(updateFn);
-
-    /* Apply any passive or active forces acting on the particles */
-    auto fn = [this](Particle& p) {
-        p.velocity += latentForce;
-        p.velocity -= p.velocity * boxFriction;
-    };
-    particles.forEach(fn);
-
-    if (intraParticleGravitation) {
-        auto particlePull = [this](ParticlePair& pair) {
-            Particle& p1 = *pair.p1;
-            Particle& p2 = *pair.p2;
-            Vector d = p1.position - p2.position;
-            Scalar dLen2 = Geometry::sqr(d);
-            p1.velocity -= d.normalize()/dLen2;
-            p2.velocity += d.normalize()/dLen2;
+    /* Park the particles that have stayed slow for long enough: */
+    if (sleepSpeed>Scalar(0))
+    {
+        Scalar sleepSpeed2=Math::sqr(sleepSpeed);
+        for (size_t i=0;i<numParticles;++i)
+        {
+            ParticleState& ps=particleStates[i];
+            if (!ps.asleep && ps.handle!=noHandle)
+            {
+                if (Geometry::sqr(velocities[i])<sleepSpeed2)
+                {
+                    ps.restTime+=stepTime;
+                    if (ps.restTime>=sleepDelay)
+                        fallAsleep(ParticleIndex(i));
+                }
+                else
+                    ps.restTime=Scalar(0);
+            }
+        }
+    }
+    
+    /* Move all collisions queued beyond this step into the time frame of the next step: */
+    if (persistentQueue) {
+        Misc::RegionTimers::Scope timerScope(stepTimers,QueueBuildRegion);
+        
+        auto rebaseFn = [stepTime](CollisionEvent& e) {
+            e.collisionTime -= stepTime;
         };
-        particlePairs.forEach(particlePull);
+        collisionQueue.forEach(rebaseFn);
+        for (typename std::vector<CollisionEvent>::iterator ncIt = nextCollisions.begin(); ncIt != nextCollisions.end(); ++ncIt) {
+            rebaseFn(*ncIt);
+        }
     }
     
     /* Update the collision sphere to the end of the time step: */
-    spherePosition+=sphereVelocity*(timeStep-sphereTimeStamp);
+    spherePosition+=sphereVelocity*(stepTime-sphereTimeStamp);
     sphereTimeStamp=Scalar(0);
+    eventCounts.addStep(stepStats,stepTime<timeStep);
+    stepTimers.finishFrame();
+    
+    return stepTime;
 }
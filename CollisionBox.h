@@ -1,15 +1,16 @@
 /***********************************************************************
 CollisionBox - Class to represent a rectangular box containing spheres
-of a fixed radius interacting by fully elastic collisions.
+of a fixed radius interacting by elastic or inelastic collisions.
 Copyright (c) 2005 Oliver Kreylos
 ***********************************************************************/
 
 #ifndef COLLISIONBOX_INCLUDED
 #define COLLISIONBOX_INCLUDED
 
-#include <Misc/Array.h>
-#include <Misc/ChunkedArray.h>
-#include <Misc/PriorityHeap.h>
+#include <Misc/ArrayIndex.h>
+#include <Misc/RegionTimers.h>
+#include <Misc/WorkerPool.h>
+#include <Math/Constants.h>
 #include <Geometry/ComponentArray.h>
 #include <Geometry/Point.h>
 #include <Geometry/Vector.h>
@@ -17,6 +18,11 @@ Copyright (c) 2005 Oliver Kreylos
 
 #include <Extra/Debug.h>
 #include <list>
+#include <vector>
+
+#include "GridArray.h"
+#include "CollisionQueue.h"
+#include "BarnesHutTree.h"
 
 template <class ScalarParam, int dimensionParam>
 class CollisionBox
@@ -30,209 +36,435 @@ public:
     typedef Geometry::ComponentArray<Scalar, dimensionParam> Size; // Data type for sizes
     typedef Geometry::Box<Scalar, dimensionParam> Box; // Data type for axis-aligned boxes
     
+    typedef unsigned int ParticleIndex; // Data type for indices into the particle arrays; simulate() periodically reorders the particles by grid cell
+    static const ParticleIndex noParticle=~ParticleIndex(0); // Index denoting the absence of a particle
+    typedef unsigned int ParticleHandle; // Data type for particle identifiers that stay valid until the particle is removed; handles of removed particles are re-used
+    static const ParticleHandle noHandle=~ParticleHandle(0); // Handle denoting the absence of a particle
+    
+    enum CellLayout // Memory layouts of the grid cell array; particles are sorted in the same order
+    {
+        RowMajorCells, MortonCells
+    };
+    
+    enum QueueType // Data structures holding the predicted collision events, in the same order as CollisionQueue::Implementation
+    {
+        BinaryHeapQueue, DaryHeapQueue, CalendarQueue
+    };
+    
+    enum StepRegion // Phases of simulate() whose run times are measured, in the order of the regions in getStepTimers()
+    {
+        SortingRegion, QueueBuildRegion, EventLoopRegion, IntegrationRegion, GravityRegion
+    };
+    
 private:
     struct GridCell; // Forward declaration
     struct CollisionEvent; // Forward declaration
-    struct ParticlePair; // Forward declaration
     
 public:
-    class Particle // Class for fixed-radius spherical particles
+    class Particle // Read-only adapter for a single fixed-radius spherical particle in the collision box's particle arrays
     {
         friend class CollisionBox;
-        friend class GridCell;
-        friend class CollisionEvent;
         
     private:
         /* Elements: */
-        Point position; // Current position of particle in collision box coordinates
-        GridCell* cell; // Pointer to grid cell currently containing the particle
-        Vector velocity; // Current velocity of particle in collision box coordinate
-        Scalar timeStamp; // Time stamp of particle in current simulation step
-        Particle* cellPred; // Pointer to particle's predecessor in same grid cell
-        Particle* cellSucc; // Pointer to particle's successor in same grid cell
+        const CollisionBox* box; // Collision box containing the particle
+        ParticleIndex index; // Index of the particle in the collision box's particle arrays
+        
+        /* Constructors and destructors: */
+        Particle(const CollisionBox* sBox, ParticleIndex sIndex)
+            :box(sBox), index(sIndex)
+        {
+        }
         
         /* Methods: */
     public:
+        ParticleIndex getIndex(void) const // Returns the particle's current index; only valid until the next call to simulate()
+        {
+            return index;
+        }
+        ParticleHandle getHandle(void) const // Returns the particle's handle, or noHandle if the particle was removed
+        {
+            return box->particleStates[index].handle;
+        }
         const Point& getPosition(void) const // Returns the particle's position
         {
-            return position;
+            return box->positions[index];
         }
         const Vector& getVelocity(void) const // Returns the particle's velocity
         {
-            return velocity;
+            return box->velocities[index];
+        }
+        bool isAsleep(void) const // Returns true if the particle is parked
+        {
+            return box->particleStates[index].asleep;
+        }
+        bool isRemoved(void) const // Returns true if the particle was removed since the last call to simulate(); its position and velocity are stale
+        {
+            return box->particleStates[index].handle==noHandle;
+        }
+    };
+    
+    class ParticleList // Adapter presenting the collision box's particle arrays as a list of particles
+    {
+        friend class CollisionBox;
+        
+    private:
+        /* Elements: */
+        const CollisionBox* box; // Collision box containing the particles
+        
+        /* Constructors and destructors: */
+        ParticleList(const CollisionBox* sBox)
+            :box(sBox)
+        {
+        }
+        
+        /* Methods: */
+    public:
+        size_t size(void) const // Returns the number of particle slots, including removed particles that keep their slots until the next call to simulate()
+        {
+            return box->numParticles;
+        }
+        Particle operator[](size_t index) const // Returns the particle of the given index; removed particles keep their indices until the next call to simulate()
+        {
+            return Particle(box,ParticleIndex(index));
+        }
+        template <class FunctorParam>
+        void forEach(FunctorParam& functor) const // Applies the given functor to each particle in index order, skipping removed particles
+        {
+            for (size_t i=0;i<box->numParticles;++i)
+                if (box->particleStates[i].handle!=noHandle)
+                    functor(Particle(box,ParticleIndex(i)));
         }
     };
     
-    typedef Misc::ChunkedArray<Particle> ParticleList; // Data type for lists of particles
+    #ifdef COLLISIONBOX_CONFIG_NOSTATS
+    static const bool collectStats=false; // Flag whether simulate() fills in per-step statistics; disabled at compile time
+    #else
+    static const bool collectStats=true; // Flag whether simulate() fills in per-step statistics; disable by defining COLLISIONBOX_CONFIG_NOSTATS
+    #endif
     
-private:
-    struct GridCell // Structure for grid cells containing particles
+    struct SimulationStats // Structure describing the events queued and handled by one call of simulate(); all counts stay zero if collectStats is false
     {
     public:
         /* Elements: */
-        Box boundaries; // Cell's bounding box (waste of space, really; should optimize this out)
-        Particle* particlesHead; // Pointer to first particle in grid cell
-        Particle* particlesTail; // Pointer to last particle in grid cell
+        size_t numQueuedCellChanges; // Number of queued cell changes
+        size_t numQueuedListUpdates; // Number of queued neighbor list updates
+        size_t numQueuedWallCollisions; // Number of queued particle/wall collisions
+        size_t numQueuedSphereCollisions; // Number of queued particle/spherical obstacle collisions
+        size_t numQueuedParticleCollisions; // Number of queued particle/particle collisions
+        size_t numCellChanges; // Number of particles crossing grid cell borders
+        size_t numListUpdates; // Number of particles moving far enough from their neighbor list centers to rebuild their lists
+        size_t numWallCollisions; // Number of particle/wall collisions
+        size_t numSphereCollisions; // Number of particle/spherical obstacle collisions
+        size_t numParticleCollisions; // Number of particle/particle collisions
+        size_t numOutdatedEvents; // Number of dequeued collisions whose partner changed course or was removed after they were predicted
+        size_t numRepeatedCollisions; // Number of particle/particle collisions of two particles that collided with each other a vanishing time before
+        size_t maxQueuedEvents; // Largest number of events held by the collision queue during the step
         
         /* Constructors and destructors: */
-        GridCell(void) // Creates uninitialized grid cell
+        SimulationStats(void) // Creates zero counts
+            :numQueuedCellChanges(0), numQueuedListUpdates(0), numQueuedWallCollisions(0),
+             numQueuedSphereCollisions(0), numQueuedParticleCollisions(0),
+             numCellChanges(0), numListUpdates(0), numWallCollisions(0), numSphereCollisions(0),
+             numParticleCollisions(0), numOutdatedEvents(0), numRepeatedCollisions(0), maxQueuedEvents(0)
         {
         }
         
         /* Methods: */
-        void addParticle(Particle* newParticle)
+        size_t getNumQueuedEvents(void) const // Returns the total number of events put into the collision queue, including replacements of a particle's queued event
         {
-            /* Link the new particle to the end of the cell's particle list: */
-            newParticle->cell=this;
-            newParticle->cellPred=particlesTail;
-            newParticle->cellSucc=0;
-            if (particlesTail!=0)
-                particlesTail->cellSucc=newParticle;
-            else
-                particlesHead=newParticle;
-            particlesTail=newParticle;
+            return numQueuedCellChanges+numQueuedListUpdates+numQueuedWallCollisions+numQueuedSphereCollisions+numQueuedParticleCollisions;
         }
-
-        void removeParticle(Particle* removeParticle)
+        size_t getNumEvents(void) const // Returns the total number of events taken from the collision queue
         {
-            /* Unlink the particle from the end of the cell's list: */
-            removeParticle->cell=0;
-            if (removeParticle->cellPred!=0)
-                removeParticle->cellPred->cellSucc=removeParticle->cellSucc;
-            else
-                particlesHead=removeParticle->cellSucc;
-            if (removeParticle->cellSucc!=0)
-                removeParticle->cellSucc->cellPred=removeParticle->cellPred;
-            else
-                particlesTail=removeParticle->cellPred;
+            return numCellChanges+numListUpdates+numWallCollisions+numSphereCollisions+numParticleCollisions+numOutdatedEvents;
         }
-
-        void unshiftParticle(Particle* newParticle)
+    };
+    
+    struct EventCounts // Structure counting the events handled by simulate(), summed over the steps' statistics
+    {
+    public:
+        /* Elements: */
+        size_t numSteps; // Number of simulation steps
+        size_t numCellChanges; // Number of particles crossing grid cell borders
+        size_t numListUpdates; // Number of particles moving far enough from their neighbor list centers to rebuild their lists
+        size_t numWallCollisions; // Number of particle/wall collisions
+        size_t numSphereCollisions; // Number of particle/spherical obstacle collisions
+        size_t numParticleCollisions; // Number of particle/particle collisions
+        size_t numOutdatedEvents; // Number of dequeued collisions whose partner changed course after they were predicted
+        size_t numRepeatedCollisions; // Number of particle/particle collisions of two particles that collided with each other a vanishing time before
+        size_t numTruncatedSteps; // Number of steps that stopped early at their event budget, deadline, or an event storm
+        size_t maxQueuedEvents; // Largest number of events held by the collision queue at any time
+        
+        /* Constructors and destructors: */
+        EventCounts(void) // Creates zero counts
+            :numSteps(0), numCellChanges(0), numListUpdates(0), numWallCollisions(0),
+             numSphereCollisions(0), numParticleCollisions(0), numOutdatedEvents(0),
+             numRepeatedCollisions(0), numTruncatedSteps(0), maxQueuedEvents(0)
+        {
+        }
+        
+        /* Methods: */
+        size_t getNumEvents(void) const // Returns the total number of events taken from the collision queue
+        {
+            return numCellChanges+numListUpdates+numWallCollisions+numSphereCollisions+numParticleCollisions+numOutdatedEvents;
+        }
+        void addStep(const SimulationStats& stats, bool truncated) // Adds the statistics of one simulation step, which stopped early if truncated is true
         {
-            /* Link the new particle to the beginning of the cell's particle list: */
-            newParticle->cell=this;
-            newParticle->cellPred=0;
-            newParticle->cellSucc=particlesHead;
-            particlesHead=newParticle;
+            ++numSteps;
+            if (truncated)
+                ++numTruncatedSteps;
+            numCellChanges+=stats.numCellChanges;
+            numListUpdates+=stats.numListUpdates;
+            numWallCollisions+=stats.numWallCollisions;
+            numSphereCollisions+=stats.numSphereCollisions;
+            numParticleCollisions+=stats.numParticleCollisions;
+            numOutdatedEvents+=stats.numOutdatedEvents;
+            numRepeatedCollisions+=stats.numRepeatedCollisions;
+            if (maxQueuedEvents<stats.maxQueuedEvents)
+                maxQueuedEvents=stats.maxQueuedEvents;
+        }
+    };
+    
+private:
+    typedef Misc::ArrayIndex<dimensionParam> Index; // Data type for cell indices
+    
+    struct ParticleState // Structure for the bookkeeping of a particle's grid cell and collision predictions
+    {
+    public:
+        /* Elements: */
+        Index cell; // Index of grid cell currently containing the particle
+        ParticleHandle handle; // Particle's handle, or noHandle if the particle was removed since the last reordering
+        ParticleIndex cellPred; // Index of particle's predecessor in its grid cell's list of moved particles
+        ParticleIndex cellSucc; // Index of particle's successor in its grid cell's list of moved particles
+        unsigned int eventCounter; // Number of changes to the particle's trajectory; used to detect outdated collision events
+        ParticleIndex lastPartner; // Index of the particle's partner in its last particle/particle collision, or noParticle
+        Scalar lastCollisionTime; // Time of the particle's last particle/particle collision relative to the current step
+        Scalar lastImpactTime; // Time of the particle's last particle/particle or particle/wall collision relative to the current step, tracked while collisions are inelastic
+        bool predictionPending; // Flag whether the particle's collisions have to be re-predicted at the beginning of the next step
+        unsigned int pendingPosition; // Position of the particle in the list of particles to re-predict while predictionPending is set
+        bool asleep; // Flag whether the particle is parked; parked particles do not move, are not integrated, and have no queued events
+        Scalar restTime; // Time for which the particle has been slower than the sleep speed
+        bool inSortedCell; // Flag whether the particle is still in the grid cell it was sorted into at the last reordering
+        
+        /* Constructors and destructors: */
+        ParticleState(const Index& sCell) // Creates the state of a new moving particle in the given grid cell, without a handle
+            :cell(sCell), handle(noHandle), cellPred(noParticle), cellSucc(noParticle),
+             eventCounter(0), lastPartner(noParticle), lastCollisionTime(0), lastImpactTime(-Math::Constants<Scalar>::max),
+             predictionPending(false), pendingPosition(0), asleep(false), restTime(0), inSortedCell(false)
+        {
+        }
+    };
+    
+    struct GridCell // Structure for grid cells containing particles; a cell's bounds are derived from its index
+    {
+    public:
+        /* Elements: */
+        ParticleIndex sortedBegin, sortedEnd; // Range of particles sorted into the grid cell at the last reordering; some may have left since
+        ParticleIndex movedHead; // Index of first particle that moved into the grid cell since the last reordering
+        
+        /* Constructors and destructors: */
+        GridCell(void) // Creates an empty grid cell
+            :sortedBegin(0), sortedEnd(0), movedHead(noParticle)
+        {
+        }
+        
+        /* Methods: */
+        void addParticle(ParticleIndex newParticle, ParticleState* states)
+        {
+            /* Link the new particle to the front of the cell's list of moved particles: */
+            ParticleState& ps=states[newParticle];
+            ps.cellPred=noParticle;
+            ps.cellSucc=movedHead;
+            if (movedHead!=noParticle)
+                states[movedHead].cellPred=newParticle;
+            movedHead=newParticle;
         }
 
-        void shiftParticle(Particle* removeParticle)
+        void removeParticle(ParticleIndex removeParticle, ParticleState* states)
         {
-            /* Unlink the particle from the beginning of the cell's list: */
-            removeParticle->cell=0;
-            if (removeParticle->cellPred!=0)
-                removeParticle->cellPred->cellSucc=removeParticle->cellSucc;
+            /* Unlink the particle from the cell's list of moved particles: */
+            ParticleState& ps=states[removeParticle];
+            if (ps.cellPred!=noParticle)
+                states[ps.cellPred].cellSucc=ps.cellSucc;
             else
-                particlesHead=removeParticle->cellSucc;
-            if (removeParticle->cellSucc!=0)
-                removeParticle->cellSucc->cellPred=removeParticle->cellPred;
+                movedHead=ps.cellSucc;
+            if (ps.cellSucc!=noParticle)
+                states[ps.cellSucc].cellPred=ps.cellPred;
+        }
+        
+        template <class FunctorParam>
+        void forEachParticle(const ParticleState* states, FunctorParam& functor) const // Calls the functor with the index of each particle in the grid cell
+        {
+            /* Visit the sorted particles that are still in the cell, then the particles that moved in: */
+            for (ParticleIndex particle=sortedBegin;particle<sortedEnd;++particle)
+                if (states[particle].inSortedCell)
+                    functor(particle);
+            for (ParticleIndex particle=movedHead;particle!=noParticle;particle=states[particle].cellSucc)
+                functor(particle);
         }
     };
     
-    typedef Misc::Array<GridCell, dimensionParam> CellArray; // Data type for arrays of grid cells
-    typedef typename CellArray::Index Index; // Data type for cell indices
+    typedef GridArray<GridCell, dimensionParam> CellArray; // Data type for arrays of grid cells
     
-    struct CollisionEvent // Structure to report potential collisions between a particle and a wall or two particles
+    struct CollisionEvent // Structure to report potential collisions between a particle and a wall or two particles; the particle owning the event is implied by where the event is stored
     {
         /* Embedded classes: */
-        enum CollisionType // Two kinds of collision: particle/wall and particle/particle, and one pseudo-collision
+        enum CollisionType // Three kinds of collision: particle/wall, particle/sphere, and particle/particle, and two pseudo-collisions
         {
-            CellChange, WallCollision, SphereCollision, ParticleCollision
+            CellChange, NeighborListUpdate, WallCollision, SphereCollision, PartnerRemoved, NoCollision, ParticleCollision
         };
         
+        static const ParticleIndex firstTag=noParticle-NoCollision; // Partner values from here up encode the types of events not involving a second particle
+        
     public:
         /* Elements: */
-        CollisionType collisionType; // Type of this collision
         Scalar collisionTime; // Time at which this collision would occur
-        Particle* particle1; // Pointer to first colliding particle
-        Scalar timeStamp1; // Time stamp of first particle at time collision was detected
-        int cellChangeDirection; // The index of the cell border crossed by the object
-        Vector wallNormal; // Normal vector of wall involved in collision
-        Particle* particle2; // Pointer to second colliding particle
-        Scalar timeStamp2; // Time stamp of second particle at time collision was detected
+        ParticleIndex partner; // Index of second colliding particle, or firstTag plus the collision type
+        unsigned int payload; // Event counter of second particle (or spherical obstacle) at time collision was detected, or index of the crossed cell border or wall
         
         /* Constructors and destructors: */
-        CollisionEvent(Scalar sCollisionTime, Particle* sParticle1,
-                       int sCellChangeDirection)
-            :collisionType(CellChange), collisionTime(sCollisionTime), 
-             particle1(sParticle1), timeStamp1(particle1->timeStamp), 
-             cellChangeDirection(sCellChangeDirection),
-             wallNormal(0), particle2(NULL), timeStamp2(Scalar(0))
-        {
-        }
-        CollisionEvent(Scalar sCollisionTime, Particle* sParticle1,
-                       const Vector& sWallNormal)
-            :collisionType(WallCollision), collisionTime(sCollisionTime), 
-             particle1(sParticle1), timeStamp1(particle1->timeStamp), 
-             wallNormal(sWallNormal),
-             particle2(NULL), timeStamp2(Scalar(0))
+        CollisionEvent(Scalar sCollisionTime) // Creates a placeholder for a collision that does not occur before the given time
+            :collisionTime(sCollisionTime), partner(firstTag+NoCollision), payload(0)
         {
         }
-        CollisionEvent(Scalar sCollisionTime, Particle* sParticle1, Scalar sphereTimeStamp)
-            :collisionType(SphereCollision), collisionTime(sCollisionTime), 
-             particle1(sParticle1), timeStamp1(particle1->timeStamp), 
-             particle2(NULL), timeStamp2(sphereTimeStamp)
+        CollisionEvent(Scalar sCollisionTime, CollisionType sCollisionType, unsigned int sPayload) // Creates a cell change, wall collision, or sphere collision
+            :collisionTime(sCollisionTime), partner(firstTag+sCollisionType), payload(sPayload)
         {
         }
-        CollisionEvent(Scalar sCollisionTime, Particle* sParticle1, Particle* sParticle2)
-            :collisionType(ParticleCollision), collisionTime(sCollisionTime), 
-             particle1(sParticle1), timeStamp1(particle1->timeStamp), 
-             particle2(sParticle2), timeStamp2(particle2->timeStamp)
+        CollisionEvent(Scalar sCollisionTime, ParticleIndex sParticle2, unsigned int sEventCounter2) // Creates a collision with another particle
+            :collisionTime(sCollisionTime), partner(sParticle2), payload(sEventCounter2)
         {
         }
         
         /* Methods: */
+        void setPartnerRemoved(void) // Turns a collision with another particle into a placeholder for the removed partner, which re-predicts the particle's collisions at the same time
+        {
+            partner=firstTag+PartnerRemoved;
+            payload=0;
+        }
+        CollisionType getCollisionType(void) const // Returns the type of this collision
+        {
+            return partner<firstTag ? ParticleCollision : CollisionType(partner-firstTag);
+        }
+        int getBorderIndex(void) const // Returns the index of the crossed cell border or wall; 2*axis for the lower and 2*axis+1 for the upper border
+        {
+            return int(payload);
+        }
         friend bool operator<=(const CollisionEvent& e1, const CollisionEvent& e2)
         {
             return e1.collisionTime<=e2.collisionTime;
         }
     };
     
-    typedef Misc::PriorityHeap<CollisionEvent> CollisionQueue; // Data types for priority queues of collision events
-    
-    struct ParticlePair {
-        ParticlePair(Particle* p, Particle* q)
-            : p1(p), p2(q) { }
-        Particle* p1;
-        Particle* p2;
+    struct CollisionEventKey // Class returning the sort key of collision events in calendar queues
+    {
+        static double getKey(const CollisionEvent& event)
+        {
+            return double(event.collisionTime);
+        }
     };
-
-    typedef Misc::ChunkedArray<ParticlePair> ParticlePairs;
-
-    ParticlePairs particlePairs;
-
+    
+    typedef ::CollisionQueue<CollisionEvent, CollisionEventKey> CollisionQueue; // Data type for priority queues holding the next collision event of each particle
+    
+    typedef BarnesHutTree<Scalar, dimensionParam> GravityTree; // Data type for trees approximating the gravitation between particles
+    
     /* Elements: */
     Box boundaries; // Bounding box of entire collision box
+    Scalar cellSizeFactor; // Requested edge length of the grid cells as a multiple of the particle diameter
+    bool autoCellSize; // Whether simulate() picks the cell size factor from the particles' density and mean free path
+    bool cellSizeTuned; // Flag whether the cell size factor was picked since automatic cell sizes were enabled
     Size cellSize; // Size of an individual cell
     int numCells[dimension]; // Number of interior cells
+    int stencilRadius; // Largest distance in cells along each axis between a cell and its neighbors; also the number of layers of ghost cells
     CellArray cells; // Array of grid cells
-    ssize_t directNeighborOffsets[dimension*2]; // Offsets between a cell and its direct neighbors
-    int numNeighbors; // Number of direct neighbors of a cell (including the cell itself)
-    ssize_t* neighborOffsets; // Pointer offsets between a cell and its neighbors
+    int numNeighbors; // Number of neighbors of a cell (including the cell itself)
+    Index* neighborOffsets; // Index offsets between a cell and its neighbors
     int* cellChangeMasks; // Array of cell change direction masks for each neighbor
+    Scalar neighborSkin; // Distance by which neighbor lists reach beyond touching particles; 0: collision partners are found in the neighboring grid cells
+    std::vector<Point> listCenters; // Position of each particle when its neighbor list was last built; grid cells hold particles by list center while neighbor lists are used
+    std::vector<std::vector<ParticleIndex> > neighborLists; // Particles whose list centers are at most one diameter plus the skin away from each particle's list center
+    std::vector<ParticleIndex> oldNeighbors; // Scratch list of a particle's neighbors before its neighbor list is rebuilt
     Scalar particleRadius, particleRadius2; // Radius and squared radius of all particles
     Scalar attenuation; // Factor by how much particles slow down over the course of one time unit; ==1: no slowdown
     size_t numParticles; // Number of particles in the collision box
-    ParticleList particles; // List of all particles in the collision box
+    std::vector<Point> positions; // Positions of all particles at their time stamps
+    std::vector<Vector> velocities; // Velocities of all particles
+    std::vector<Scalar> timeStamps; // Time stamps of all particles in the current simulation step
+    std::vector<ParticleState> particleStates; // Grid cell and prediction bookkeeping of all particles
+    std::vector<ptrdiff_t> sortedCells; // Linear indices of all grid cells that received particles at the last reordering, in ascending order
+    size_t numUnsortedParticles; // Number of particles that left their sorted grid cells or were added since the last reordering
+    size_t numRemovedParticles; // Number of removed particles that keep their array slots until the next reordering
+    std::vector<ParticleIndex> handleIndices; // Current index of the particle associated with each handle, or noParticle for unused handles
+    std::vector<ParticleHandle> freeHandles; // Handles of removed particles, to be re-used by new particles
+    Scalar reorderThreshold; // Fraction of unsorted particles above which simulate() reorders the particle arrays
     Point spherePosition; // Position of an additional spherical obstacle
     Vector sphereVelocity; // Velocity of spherical obstacle
     Scalar sphereRadius, sphereRadius2; // Radius and squared radius of spherical obstacle
     Scalar sphereTimeStamp; // Time stamp of spherical obstacle in current time step
+    unsigned int sphereEventCounter; // Number of changes to the spherical obstacle's trajectory
     Vector latentForce; // Force (e.g. gravity) to apply to the particles at every step
     Scalar boxFriction; // Latent friction applied to all particles
     bool intraParticleGravitation; // Whether or not to simulate gravity between particles
+    Scalar gravitationOpeningAngle; // Opening angle below which groups of particles are treated as a single mass; 0: exact pairwise gravitation
+    GravityTree gravityTree; // Tree of particle positions rebuilt at every step when simulating intra-particle gravitation
+    bool persistentQueue; // Whether the collision queue is kept between simulation steps
+    bool queueInitialized; // Flag whether the collision queue contains valid predictions for all particles
+    Scalar sleepSpeed; // Speed below which particles are parked after the sleep delay; 0: particles are never parked
+    Scalar sleepDelay; // Time for which a particle has to stay slower than the sleep speed before it is parked
+    size_t numSleepingParticles; // Number of parked particles
+    Scalar restitution; // Fraction of the normal approach speed kept by colliding particles, or by particles bouncing off a wall
+    Scalar contactTime; // Time after a particle's last collision during which its collisions are elastic, to prevent inelastic collapse
+    size_t stormThreshold; // Number of repeated collisions after which simulate() stops a step early; 0: steps are never stopped for event storms
+    size_t numRepeatedCollisions; // Number of repeated collisions during the current or last simulation step
+    Scalar lastTimeStep; // Length of the current or last simulation step, or 0 before the first step
+    Scalar predictionHorizon; // Time up to which particle, wall, and cell collisions are predicted during the current step
+    CollisionQueue collisionQueue; // Queue holding the next event, collision or cell change, of each particle
+    std::vector<CollisionEvent> nextCollisions; // Earliest predicted collision of each particle, not counting cell changes
+    std::vector<ParticleIndex> pendingParticles; // List of particles whose collisions have to be re-predicted at the beginning of the next step
+    int numThreads; // Number of threads sharing the prediction and update phases of a simulation step
+    Misc::WorkerPool workerPool; // Threads helping the calling thread with the prediction and update phases; started by setNumThreads()
+    std::vector<std::vector<ParticleIndex> > threadParticles; // Per-thread lists of particles collected during a parallel phase
+    SimulationStats stepStats; // Statistics of the current or last simulation step
+    EventCounts eventCounts; // Number of events handled since creation or the last reset
+    Misc::RegionTimers stepTimers; // Time spent in each phase of simulate(), with one frame per step
 
     /* Private methods: */
-    void queueCollisionsInCell(GridCell* cell, Particle* particle1, Scalar timeStep,
-                               bool symmetric, Particle* otherParticle,
-                               CollisionQueue& collisionQueue);
-    void queueCellChanges(Particle* particle, const Point& newPosition,
-                          Scalar timeStep, CollisionQueue& collisionQueue);
-    void queueCollisions(Particle* particle1, Scalar timeStep, bool symmetric,
-                         Particle* otherParticle, CollisionQueue& collisionQueue);
-    void queueCollisionsOnCellChange(Particle* particle1, Scalar timeStep,
-                                     int cellChangeDirection,
-                                     CollisionQueue& collisionQueue);
+    void createCells(Scalar newCellSizeFactor); // Creates empty grid cells of the given multiple of the particle diameter and the matching neighbor stencil
+    Index calcCellIndex(const Point& position) const; // Returns the index of the interior grid cell containing the given position
+    void rebuildCells(void); // Sorts all particles into the grid cells containing their current positions and re-builds all neighbor lists around those positions; only valid between simulation steps
+    Point clampToBox(const Point& position) const; // Returns the position closest to the given one at which a particle lies entirely inside the box
+    bool overlapsParticles(const Point& position, const Index& cell); // Returns true if a particle at the given position in the given grid cell would overlap any particle in the grid cells around it
+    ParticleIndex appendParticle(const Point& newPosition, const Vector& newVelocity, const Index& cell); // Appends a particle in the given grid cell to the particle arrays and associates it with a free handle, without linking it into the cell or to its neighbors; returns its index
+    void moveToCell(ParticleIndex particle, const Index& newCell); // Moves the particle from its current grid cell into the given one
+    void buildNeighborList(ParticleIndex particle, bool symmetric); // Adds all particles in range of the particle's list center, or only those of higher index if symmetric is false, to its neighbor list and the particle to theirs
+    void unlinkNeighbors(ParticleIndex particle); // Removes the particle from the neighbor lists of all particles in its own list
+    template <class FunctorParam>
+    void forEachNeighbor(ParticleIndex particle, FunctorParam& functor); // Calls the functor with the index of each particle in the particle's neighbor list or neighboring grid cells, including the particle itself in the latter case
+    void schedulePrediction(ParticleIndex particle); // Appends the particle to the list of particles whose collisions are re-predicted at the beginning of the next step; the particle must not be in the list yet
+    void fallAsleep(ParticleIndex particle); // Parks the particle at its current position; only valid between simulation steps
+    void wakeParticle(ParticleIndex particle); // Un-parks the particle and predicts its collisions at the beginning of the next step; only valid between simulation steps
+    void wakeContacts(ParticleIndex particle, Scalar time, Scalar timeStep); // Un-parks all particles touching the particle at the given time during a simulation step and queues their collisions
+    void wakeSphereContacts(Scalar timeStep); // Un-parks all particles the spherical obstacle can reach during the next simulation step
+    Scalar findCellSizeFactor(void) const; // Returns the cell size factor that minimizes the estimated work per simulated time unit, or the current factor if no other one is clearly better
+    void findParticleCollision(ParticleIndex particle1, ParticleIndex particle2, CollisionEvent& nextCollision);
+    void findCollisionsInCell(GridCell* cell, ParticleIndex particle1,
+                              bool symmetric, ParticleIndex otherParticle,
+                              CollisionEvent& nextCollision);
+    void findCellChange(ParticleIndex particle, CollisionEvent& nextCollision);
+    void findListExit(ParticleIndex particle, CollisionEvent& nextCollision);
+    void findSphereCollision(ParticleIndex particle, Scalar timeStep,
+                             CollisionEvent& nextCollision);
+    void queueNextEvent(ParticleIndex particle);
+    void predictCollisions(ParticleIndex particle1, Scalar timeStep, bool symmetric,
+                           ParticleIndex otherParticle); // Calculates the particle's earliest collision without queueing it; safe to call concurrently for different particles
+    void queueCollisions(ParticleIndex particle1, Scalar timeStep, bool symmetric,
+                         ParticleIndex otherParticle);
+    void queueCollisionsOnCellChange(ParticleIndex particle, int cellChangeDirection);
+    void sortParticles(void); // Reorders the particle arrays by grid cell so that each cell's particles are contiguous, drops removed particles, and renumbers all references to particles
+    void invalidatePrediction(ParticleIndex particle, std::vector<ParticleIndex>& pending); // Marks the particle's queued collisions as outdated after a change of velocity outside of a collision, which also ends its series of repeated collisions; appends the particle to the given list if it has to be re-predicted
+    template <class FunctorParam>
+    void runParallel(size_t numItems, FunctorParam& functor); // Splits the items into one contiguous range per thread and calls functor(threadIndex, begin, end) for all ranges concurrently on the worker pool
     
     /* Constructors and destructors: */
 public:
@@ -244,9 +476,11 @@ public:
         return boundaries;
     }
     void setAttenuation(Scalar newAttenuation); // Sets new attenuation factor for particle velocities
-    bool addParticle(const Point& newPosition, const Vector& newVelocity); // Adds a new particle to the collision box; returns false if particle could not be added due to overlap with existing particles
+    bool addParticle(const Point& newPosition, const Vector& newVelocity, ParticleHandle* newHandle =0); // Adds a new particle to the collision box and optionally returns its handle; returns false if particle could not be added due to overlap with existing particles
+    size_t addParticles(const std::vector<Point>& newPositions, const std::vector<Vector>& newVelocities, std::vector<ParticleHandle>* newHandles =0); // Adds a batch of particles in order, sorting all particles by grid cell once and checking each new particle for overlaps against the sorted cells; optionally returns each particle's handle, or noHandle if it overlapped another particle; returns the number of added particles; throws std::runtime_error if the numbers of positions and velocities differ
+    bool removeParticle(ParticleHandle handle); // Removes the particle associated with the given handle from the collision box; returns false if there is no such particle
     void moveSphere(const Point& newPosition, Scalar timeStep); // Moves the spherical obstacle to the given position at the end of the next time step
-    void simulate(Scalar timeStep); // Advances simulation time by given time step
+    Scalar simulate(Scalar timeStep, size_t maxEvents=0, double maxSeconds=0.0); // Advances simulation time by the given time step, but stops early before handling more than the given number of events or after spending the given number of seconds, where 0 means no limit, or when an event storm is detected; returns the simulated time, up to which all particles were moved
     void setLatentForce(const Vector& force) {
         latentForce = force;
     }
@@ -256,8 +490,87 @@ public:
     void setIntraParticleGravitation(bool enable) {
         intraParticleGravitation = enable;
     }
-    const ParticleList& getParticles(void) const { // Returns the list of particles
-        return particles;
+    void setGravitationOpeningAngle(Scalar newOpeningAngle) { // Sets the accuracy of intra-particle gravitation; smaller angles are more accurate and slower
+        gravitationOpeningAngle = newOpeningAngle;
+    }
+    int getNumThreads(void) const { // Returns the number of threads used by simulate()
+        return numThreads;
+    }
+    void setNumThreads(int newNumThreads); // Sets the number of threads sharing the bulk phases of simulate(), which are predicting all collisions and updating all particles; events are always handled by the calling thread; <1 uses all hardware threads
+    void setPersistentQueue(bool enable); // Keeps predicted collisions between simulation steps and only re-predicts particles whose trajectories changed
+    CellLayout getCellLayout(void) const { // Returns the memory layout of the grid cell array
+        return cells.getLayout() == CellArray::Morton ? MortonCells : RowMajorCells;
+    }
+    void setCellLayout(CellLayout newCellLayout); // Lays out the grid cells and sorts the particles in row-major or blocked Morton order; row-major order is the default
+    Scalar getCellSizeFactor(void) const { // Returns the requested edge length of the grid cells as a multiple of the particle diameter
+        return cellSizeFactor;
+    }
+    void setCellSizeFactor(Scalar newCellSizeFactor); // Re-creates the grid with cells of at least the given multiple of the particle diameter and sorts all particles into it; factors below 1 widen the neighborhood searched for collisions; the default is 1
+    Scalar tuneCellSize(void); // Picks the cell size factor from the particles' current density and mean free path, re-creates the grid if it changed, and returns the factor
+    bool getAutoCellSize(void) const { // Returns whether simulate() picks the cell size factor automatically
+        return autoCellSize;
+    }
+    void setAutoCellSize(bool enable) { // Lets simulate() pick the cell size factor at its next call and whenever it sorts the particles by grid cell
+        autoCellSize = enable;
+        cellSizeTuned = false;
+    }
+    Scalar getNeighborSkin(void) const { // Returns the distance by which neighbor lists reach beyond touching particles, or 0 if neighbor lists are not used
+        return neighborSkin;
+    }
+    Scalar getSleepSpeed(void) const { // Returns the speed below which particles are parked, or 0 if particles are never parked
+        return sleepSpeed;
+    }
+    Scalar getSleepDelay(void) const { // Returns the time for which particles have to stay slower than the sleep speed before they are parked
+        return sleepDelay;
+    }
+    void setSleeping(Scalar newSleepSpeed, Scalar newSleepDelay); // Parks particles that stayed slower than the given speed for the given time until a collision or the spherical obstacle wakes them; a speed of 0 wakes all particles and disables parking, which is the default
+    size_t getNumSleepingParticles(void) const { // Returns the number of parked particles
+        return numSleepingParticles;
+    }
+    Scalar getRestitution(void) const { // Returns the fraction of the normal approach speed kept by colliding particles and particles bouncing off walls
+        return restitution;
+    }
+    Scalar getContactTime(void) const { // Returns the time after a particle's last collision during which its collisions are elastic
+        return contactTime;
+    }
+    void setRestitution(Scalar newRestitution, Scalar newContactTime); // Lets colliding particles and particles bouncing off walls keep the given fraction of their normal approach speed, clamped to [0, 1], where 1 is elastic and the default; collisions of particles that already collided less than the given contact time before stay elastic as in the TC model, which keeps clusters from collapsing inelastically into infinitely many collisions
+    size_t getStormThreshold(void) const { // Returns the number of repeated collisions in one step that stops the step early, or 0 if steps are never stopped for event storms
+        return stormThreshold;
+    }
+    void setStormThreshold(size_t newStormThreshold) { // Stops a step early after the given number of repeated collisions, where the same two particles collide again within a millionth of the time step, as happens when they are squeezed between walls or the spherical obstacle; 0 never stops early, which is the default
+        stormThreshold=newStormThreshold;
+    }
+    size_t getNumRepeatedCollisions(void) const { // Returns the number of repeated collisions during the last step, independent of collectStats
+        return numRepeatedCollisions;
+    }
+    void setNeighborSkin(Scalar newNeighborSkin); // Finds collision partners in per-particle neighbor lists reaching the given distance beyond touching particles, which are rebuilt when a particle moves half that distance, instead of in the neighboring grid cells; 0 disables neighbor lists, which is the default
+    QueueType getQueueType(void) const { // Returns the data structure holding the predicted collision events
+        return QueueType(collisionQueue.getImplementation());
+    }
+    void setQueueType(QueueType newQueueType); // Holds the predicted collision events in a binary heap, a cache-aligned 4-ary heap, or a calendar queue whose buckets span one simulation step; the binary heap is the default
+    void setReorderThreshold(Scalar newReorderThreshold) { // Sets the fraction of particles that must have changed grid cells before simulate() sorts the particle arrays by cell again
+        reorderThreshold = newReorderThreshold;
+    }
+    size_t getNumParticles(void) const { // Returns the number of particles, not counting removed particles
+        return numParticles-numRemovedParticles;
+    }
+    ParticleList getParticles(void) const { // Returns the list of particles
+        return ParticleList(this);
+    }
+    const SimulationStats& getLastStepStats(void) const { // Returns the statistics of the last simulation step
+        return stepStats;
+    }
+    const EventCounts& getEventCounts(void) const { // Returns the number of events handled since creation or the last reset
+        return eventCounts;
+    }
+    void resetEventCounts(void) { // Resets all event counts to zero
+        eventCounts = EventCounts();
+    }
+    const Misc::RegionTimers& getStepTimers(void) const { // Returns the time spent in each phase of the last step and of all steps since creation or the last reset, indexed by StepRegion
+        return stepTimers;
+    }
+    void resetStepTimers(void) { // Resets all phase times to zero
+        stepTimers.reset();
     }
     const Point& getSphere(void) const { // Returns the collision sphere's current position
         return spherePosition;
@@ -0,0 +1,410 @@
+/***********************************************************************
+CollisionBoxBench - Headless benchmark program for the collision box
+hard sphere simulation data structure.
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+***********************************************************************/
+
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <iostream>
+#include <strings.h>
+#include <Misc/Timer.h>
+#include <Math/Math.h>
+#include <Math/Random.h>
+#include <Math/RandomEngine.h>
+
+#include "ParticleKernels.h"
+#include "ParticleSeeding.h"
+#include "CollisionBox.h"
+
+struct BenchmarkOptions // Structure holding the benchmark's command line parameters
+{
+public:
+    /* Elements: */
+    int dimension; // Dimension of the collision box, 2 or 3
+    double boxSize; // Edge length of the cubical collision box
+    double particleRadius; // Radius of all particles
+    double sphereRadius; // Radius of the spherical obstacle
+    double sphereSpeed; // Speed at which the spherical obstacle moves into the box along the first axis
+    int numParticles; // Number of particles to add
+    int numSteps; // Number of simulation steps to run
+    double timeStep; // Length of each simulation step
+    double speedRange; // Maximum speed of the randomly-generated particles
+    double gravity; // Strength of the downward gravity
+    double friction; // Strength of the frictional force
+    double attenuation; // Factor by how much particles slow down over one time unit
+    bool particleGravity; // Whether to simulate gravity between the particles
+    double openingAngle; // Accuracy of the particle gravity
+    int numThreads; // Number of threads used by the simulation
+    bool persistentQueue; // Whether to keep the collision queue between steps
+    double reorderThreshold; // Fraction of particles that must change cells before the particles are sorted by cell again
+    double cellSizeFactor; // Edge length of the grid cells as a multiple of the particle diameter; 0 for the collision box's default
+    double neighborSkin; // Distance by which neighbor lists reach beyond touching particles; 0 to find collision partners in the grid cells
+    double sleepSpeed; // Speed below which resting particles are parked; 0 to keep all particles active
+    double sleepDelay; // Time a particle has to stay below the sleep speed before it is parked
+    double restitution; // Fraction of the normal approach speed kept by colliding particles
+    double contactTime; // Time after a particle's last collision during which its collisions are elastic
+    int maxEvents; // Number of events after which each step stops early; 0 for no limit
+    double maxSeconds; // Wall-clock time after which each step stops early; 0 for no limit
+    int stormThreshold; // Number of repeated collisions after which a step stops early; 0 to never stop for event storms
+    bool autoCellSize; // Whether the collision box picks the cell size from the particles' density and mean free path
+    std::string cellLayout; // Memory layout of the grid cells, "rowmajor" or "morton"; empty for the collision box's default
+    std::string queueType; // Data structure holding the collision events, "heap", "dary", or "calendar"; empty for the collision box's default
+    std::string seeding; // Placement of the initial particles, "random", "lattice", or "poisson"
+    unsigned int seed; // Seed for the random number generator
+
+    /* Constructors and destructors: */
+    BenchmarkOptions(void)
+        :dimension(2), boxSize(256.0), particleRadius(1.0), sphereRadius(25.0), sphereSpeed(4.0),
+         numParticles(10000), numSteps(1000), timeStep(0.01), speedRange(4.0),
+         gravity(0.0), friction(0.0), attenuation(1.0),
+         particleGravity(false), openingAngle(0.5),
+         numThreads(1), persistentQueue(false), reorderThreshold(0.1),
+         cellSizeFactor(0.0), neighborSkin(0.0), sleepSpeed(0.0), sleepDelay(0.5),
+         restitution(1.0), contactTime(0.001), maxEvents(0), maxSeconds(0.0), stormThreshold(0), autoCellSize(false), seeding("random"), seed(1)
+    {
+    }
+};
+
+template <int dimensionParam>
+int runBenchmark(const BenchmarkOptions& options)
+{
+    typedef CollisionBox<double, dimensionParam> MyCollisionBox;
+    typedef typename MyCollisionBox::Scalar Scalar;
+    typedef typename MyCollisionBox::Point Point;
+    typedef typename MyCollisionBox::Vector Vector;
+    typedef typename MyCollisionBox::Box Box;
+    typedef typename MyCollisionBox::EventCounts EventCounts;
+
+    /* Create the collision box: */
+    Misc::Timer setupTimer;
+    MyCollisionBox collisionBox(Box(Point(0), Point(options.boxSize)), Scalar(options.particleRadius), Scalar(options.sphereRadius));
+    Vector latentForce = Vector::zero;
+    latentForce[1] = Scalar(options.gravity);
+    collisionBox.setLatentForce(latentForce);
+    collisionBox.setFriction(Scalar(options.friction));
+    collisionBox.setAttenuation(Scalar(options.attenuation));
+    collisionBox.setIntraParticleGravitation(options.particleGravity);
+    collisionBox.setGravitationOpeningAngle(Scalar(options.openingAngle));
+    collisionBox.setNumThreads(options.numThreads);
+    collisionBox.setPersistentQueue(options.persistentQueue);
+    collisionBox.setReorderThreshold(Scalar(options.reorderThreshold));
+    if (!strcasecmp(options.cellLayout.c_str(), "rowmajor")) {
+        collisionBox.setCellLayout(MyCollisionBox::RowMajorCells);
+    } else if (!strcasecmp(options.cellLayout.c_str(), "morton")) {
+        collisionBox.setCellLayout(MyCollisionBox::MortonCells);
+    } else if (!options.cellLayout.empty()) {
+        throw std::runtime_error("Cell layout must be rowmajor or morton");
+    }
+    if (options.cellSizeFactor > 0.0) {
+        collisionBox.setCellSizeFactor(Scalar(options.cellSizeFactor));
+    }
+    collisionBox.setAutoCellSize(options.autoCellSize);
+    collisionBox.setNeighborSkin(Scalar(options.neighborSkin));
+    collisionBox.setSleeping(Scalar(options.sleepSpeed), Scalar(options.sleepDelay));
+    collisionBox.setStormThreshold(size_t(options.stormThreshold));
+    collisionBox.setRestitution(Scalar(options.restitution), Scalar(options.contactTime));
+    if (!strcasecmp(options.queueType.c_str(), "heap")) {
+        collisionBox.setQueueType(MyCollisionBox::BinaryHeapQueue);
+    } else if (!strcasecmp(options.queueType.c_str(), "dary")) {
+        collisionBox.setQueueType(MyCollisionBox::DaryHeapQueue);
+    } else if (!strcasecmp(options.queueType.c_str(), "calendar")) {
+        collisionBox.setQueueType(MyCollisionBox::CalendarQueue);
+    } else if (!options.queueType.empty()) {
+        throw std::runtime_error("Queue type must be heap, dary, or calendar");
+    }
+
+    /* Place the particles until the requested number is reached or the box is full: */
+    Math::seedRandom(options.seed);
+    const Box& boundaries = collisionBox.getBoundaries();
+    int numParticles;
+    if (!strcasecmp(options.seeding.c_str(), "random")) {
+        /* Try random positions until one does not overlap any existing particle: */
+        for (numParticles = 0; numParticles < options.numParticles; ++numParticles) {
+            const int maxNumTries = 200;
+            int tries;
+            for (tries = 0; tries < maxNumTries; ++tries) {
+                Point p;
+                Vector v;
+                for (int j = 0; j < dimensionParam; ++j) {
+                    p[j] = Scalar(Math::randUniformCC(boundaries.min[j]+options.particleRadius,
+                                                      boundaries.max[j]-options.particleRadius));
+                    v[j] = Scalar(Math::randUniformCC(-options.speedRange, options.speedRange));
+                }
+                if (collisionBox.addParticle(p, v)) {
+                    break;
+                }
+            }
+            if (tries == maxNumTries) {
+                break;
+            }
+        }
+    } else {
+        /* Generate non-overlapping positions that spread the requested number of particles over the box, and add them at once: */
+        ParticleSeeding::Mode mode;
+        if (!strcasecmp(options.seeding.c_str(), "lattice")) {
+            mode = ParticleSeeding::Lattice;
+        } else if (!strcasecmp(options.seeding.c_str(), "poisson")) {
+            mode = ParticleSeeding::PoissonDisk;
+        } else {
+            throw std::runtime_error("Seeding must be random, lattice, or poisson");
+        }
+        std::vector<Point> positions;
+        ParticleSeeding::generatePositions(boundaries, Scalar(options.particleRadius), size_t(options.numParticles), mode, positions);
+        std::vector<Vector> velocities(positions.size());
+        Math::RandomEngine& rng = Math::getThreadRandomEngine();
+        for (typename std::vector<Vector>::iterator vIt = velocities.begin(); vIt != velocities.end(); ++vIt) {
+            rng.fillUniformCC(vIt->getComponents(), dimensionParam, -options.speedRange, options.speedRange);
+        }
+        numParticles = int(collisionBox.addParticles(positions, velocities));
+    }
+    setupTimer.elapse();
+
+    /* Run the simulation while the spherical obstacle glides into the box from its initial position: */
+    Vector sphereStep = Vector::zero;
+    sphereStep[0] = Scalar(options.sphereSpeed*options.timeStep);
+    collisionBox.resetEventCounts();
+    collisionBox.resetStepTimers();
+    typename MyCollisionBox::SimulationStats queuedEvents; // Sums of the steps' counts of queued events
+    double simulatedTime = 0.0; // Simulation time covered by the steps, which is shorter than requested if steps stopped early
+    Misc::Timer simulationTimer;
+    for (int step = 0; step < options.numSteps; ++step) {
+        collisionBox.moveSphere(collisionBox.getSphere()+sphereStep, Scalar(options.timeStep));
+        simulatedTime += double(collisionBox.simulate(Scalar(options.timeStep), size_t(options.maxEvents), options.maxSeconds));
+        const typename MyCollisionBox::SimulationStats& stepStats = collisionBox.getLastStepStats();
+        queuedEvents.numQueuedCellChanges += stepStats.numQueuedCellChanges;
+        queuedEvents.numQueuedListUpdates += stepStats.numQueuedListUpdates;
+        queuedEvents.numQueuedWallCollisions += stepStats.numQueuedWallCollisions;
+        queuedEvents.numQueuedSphereCollisions += stepStats.numQueuedSphereCollisions;
+        queuedEvents.numQueuedParticleCollisions += stepStats.numQueuedParticleCollisions;
+    }
+    simulationTimer.elapse();
+
+    /* Report the results as a JSON object: */
+    const EventCounts& counts = collisionBox.getEventCounts();
+    double simulationTime = simulationTimer.getTime();
+    printf("{\n");
+    printf("  \"dimension\": %d,\n", dimensionParam);
+    printf("  \"boxSize\": %g,\n", options.boxSize);
+    printf("  \"particles\": %d,\n", numParticles);
+    printf("  \"steps\": %d,\n", options.numSteps);
+    printf("  \"timeStep\": %g,\n", options.timeStep);
+    printf("  \"simulatedTime\": %g,\n", simulatedTime);
+    printf("  \"truncatedSteps\": %lu,\n", (unsigned long)counts.numTruncatedSteps);
+    printf("  \"threads\": %d,\n", collisionBox.getNumThreads());
+    printf("  \"persistentQueue\": %s,\n", options.persistentQueue ? "true" : "false");
+    printf("  \"instructionSet\": \"%s\",\n", ParticleKernels::getInstructionSet());
+    printf("  \"cellLayout\": \"%s\",\n", collisionBox.getCellLayout() == MyCollisionBox::MortonCells ? "morton" : "rowmajor");
+    printf("  \"cellSizeFactor\": %g,\n", double(collisionBox.getCellSizeFactor()));
+    printf("  \"autoCellSize\": %s,\n", collisionBox.getAutoCellSize() ? "true" : "false");
+    printf("  \"neighborSkin\": %g,\n", double(collisionBox.getNeighborSkin()));
+    printf("  \"restitution\": %g,\n", double(collisionBox.getRestitution()));
+    printf("  \"contactTime\": %g,\n", double(collisionBox.getContactTime()));
+    printf("  \"sleepSpeed\": %g,\n", double(collisionBox.getSleepSpeed()));
+    printf("  \"sleepingParticles\": %lu,\n", (unsigned long)collisionBox.getNumSleepingParticles());
+    printf("  \"seeding\": \"%s\",\n", options.seeding.c_str());
+    static const char* queueNames[] = {"heap", "dary", "calendar"};
+    printf("  \"queue\": \"%s\",\n", queueNames[collisionBox.getQueueType()]);
+    printf("  \"setupSeconds\": %.6f,\n", setupTimer.getTime());
+    printf("  \"simulationSeconds\": %.6f,\n", simulationTime);
+    printf("  \"stepsPerSecond\": %.3f,\n", double(counts.numSteps)/simulationTime);
+    printf("  \"eventsPerSecond\": %.3f,\n", double(counts.getNumEvents())/simulationTime);
+    printf("  \"maxQueuedEvents\": %lu,\n", (unsigned long)counts.maxQueuedEvents);
+    const Misc::RegionTimers& stepTimers = collisionBox.getStepTimers();
+    printf("  \"regionSeconds\": {\n");
+    for (int region = 0; region < stepTimers.getNumRegions(); ++region) {
+        printf("    \"%s\": %.6f%s\n", stepTimers.getRegionName(region).c_str(), stepTimers.getTotalTime(region),
+               region+1 < stepTimers.getNumRegions() ? "," : "");
+    }
+    printf("  },\n");
+    printf("  \"statistics\": %s,\n", MyCollisionBox::collectStats ? "true" : "false");
+    printf("  \"queuedEvents\": {\n");
+    printf("    \"total\": %lu,\n", (unsigned long)queuedEvents.getNumQueuedEvents());
+    printf("    \"cellChanges\": %lu,\n", (unsigned long)queuedEvents.numQueuedCellChanges);
+    printf("    \"listUpdates\": %lu,\n", (unsigned long)queuedEvents.numQueuedListUpdates);
+    printf("    \"wallCollisions\": %lu,\n", (unsigned long)queuedEvents.numQueuedWallCollisions);
+    printf("    \"sphereCollisions\": %lu,\n", (unsigned long)queuedEvents.numQueuedSphereCollisions);
+    printf("    \"particleCollisions\": %lu\n", (unsigned long)queuedEvents.numQueuedParticleCollisions);
+    printf("  },\n");
+    printf("  \"events\": {\n");
+    printf("    \"total\": %lu,\n", (unsigned long)counts.getNumEvents());
+    printf("    \"cellChanges\": %lu,\n", (unsigned long)counts.numCellChanges);
+    printf("    \"listUpdates\": %lu,\n", (unsigned long)counts.numListUpdates);
+    printf("    \"wallCollisions\": %lu,\n", (unsigned long)counts.numWallCollisions);
+    printf("    \"sphereCollisions\": %lu,\n", (unsigned long)counts.numSphereCollisions);
+    printf("    \"particleCollisions\": %lu,\n", (unsigned long)counts.numParticleCollisions);
+    printf("    \"outdated\": %lu,\n", (unsigned long)counts.numOutdatedEvents);
+    printf("    \"repeatedCollisions\": %lu\n", (unsigned long)counts.numRepeatedCollisions);
+    printf("  }\n");
+    printf("}\n");
+
+    return 0;
+}
+
+void printUsage(const char* programName)
+{
+    /* Print all options with the defaults of a fresh option structure: */
+    BenchmarkOptions d;
+    printf("Usage: %s [options] [<number of particles>]\n", programName);
+    printf("Simulates a fixed number of steps and prints the timings and event counts as JSON.\n");
+    printf("  <number of particles>          Number of particles to add (default %d)\n", d.numParticles);
+    printf("  -h, --help                     Print this message and exit\n");
+    printf("  -d, --dimension <2|3>          Dimension of the collision box (default %d)\n", d.dimension);
+    printf("  -s, --size <FLOAT>             Edge length of the collision box (default %g)\n", d.boxSize);
+    printf("  --particle-radius <FLOAT>      Radius of the particles (default %g)\n", d.particleRadius);
+    printf("  --radius <FLOAT>               Radius of the spherical obstacle (default %g)\n", d.sphereRadius);
+    printf("  --sphere-speed <FLOAT>         Speed of the spherical obstacle along the first axis (default %g)\n", d.sphereSpeed);
+    printf("  --steps <INT>                  Number of simulation steps (default %d)\n", d.numSteps);
+    printf("  --timestep <FLOAT>             Length of each simulation step (default %g)\n", d.timeStep);
+    printf("  --speedrange <FLOAT>           Maximum initial particle speed per axis (default %g)\n", d.speedRange);
+    printf("  --gravity <FLOAT>              Strength of the downward gravity (default %g)\n", d.gravity);
+    printf("  --friction <FLOAT>             Strength of the frictional force (default %g)\n", d.friction);
+    printf("  --attenuation <FLOAT>          Factor by which particles slow down per time unit (default %g)\n", d.attenuation);
+    printf("  --particle-gravity             Simulate gravity between the particles (default off)\n");
+    printf("  --opening-angle <FLOAT>        Accuracy of the particle gravity; 0 is exact (default %g)\n", d.openingAngle);
+    printf("  --threads <INT>                Number of threads sharing the bulk phases of each step (default %d)\n", d.numThreads);
+    printf("  --persistent                   Keep the collision queue between steps (default off)\n");
+    printf("  --reorder-threshold <FLOAT>    Fraction of particles changing cells before they are sorted again (default %g)\n", d.reorderThreshold);
+    printf("  --cell-layout <rowmajor|morton> Memory order of the grid cells (default rowmajor)\n");
+    printf("  --cell-size <FLOAT|auto>       Grid cell size as a multiple of the particle diameter (default 1)\n");
+    printf("  --neighbor-skin <FLOAT>        Reach of per-particle neighbor lists beyond touching; 0 uses the grid cells (default %g)\n", d.neighborSkin);
+    printf("  --sleep-speed <FLOAT>          Speed below which resting particles are parked; 0 never parks (default %g)\n", d.sleepSpeed);
+    printf("  --sleep-delay <FLOAT>          Time below the sleep speed before a particle is parked (default %g)\n", d.sleepDelay);
+    printf("  --restitution <FLOAT>          Fraction of the normal approach speed kept in collisions (default %g)\n", d.restitution);
+    printf("  --contact-time <FLOAT>         Time after a collision during which collisions stay elastic (default %g)\n", d.contactTime);
+    printf("  --max-events <INT>             Events after which each step stops early; 0 for no limit (default %d)\n", d.maxEvents);
+    printf("  --max-seconds <FLOAT>          Wall-clock seconds after which each step stops early; 0 for no limit (default %g)\n", d.maxSeconds);
+    printf("  --storm-threshold <INT>        Repeated collisions after which a step stops early; 0 never stops (default %d)\n", d.stormThreshold);
+    printf("  --queue <heap|dary|calendar>   Data structure holding the predicted events (default heap)\n");
+    printf("  --seeding <random|lattice|poisson> Placement of the initial particles (default %s)\n", d.seeding.c_str());
+    printf("  --seed <INT>                   Seed for the random number generator (default %u)\n", d.seed);
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        /* Parse arguments: */
+        BenchmarkOptions options;
+        for (int argi = 1; argi < argc; ++argi) {
+            if (argv[argi][0] == '-') {
+                if (!strcasecmp(argv[argi], "--help") || !strcasecmp(argv[argi], "-h")) {
+                    printUsage(argv[0]);
+                    return 0;
+                } else if (!strcasecmp(argv[argi], "--persistent")) {
+                    options.persistentQueue = true;
+                } else if (!strcasecmp(argv[argi], "--particle-gravity")) {
+                    options.particleGravity = true;
+                } else if (argi+1 < argc) {
+                    /* Parameters with values */
+                    const char* value = argv[argi+1];
+                    if (!strcasecmp(argv[argi], "--dimension") || !strcasecmp(argv[argi], "-d")) {
+                        options.dimension = atoi(value);
+                    } else if (!strcasecmp(argv[argi], "--size") || !strcasecmp(argv[argi], "-s")) {
+                        options.boxSize = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--particle-radius")) {
+                        options.particleRadius = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--radius")) {
+                        options.sphereRadius = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--sphere-speed")) {
+                        options.sphereSpeed = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--steps")) {
+                        options.numSteps = atoi(value);
+                    } else if (!strcasecmp(argv[argi], "--timestep")) {
+                        options.timeStep = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--speedrange")) {
+                        options.speedRange = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--gravity")) {
+                        options.gravity = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--friction")) {
+                        options.friction = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--attenuation")) {
+                        options.attenuation = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--opening-angle")) {
+                        options.openingAngle = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--threads")) {
+                        options.numThreads = atoi(value);
+                    } else if (!strcasecmp(argv[argi], "--reorder-threshold")) {
+                        options.reorderThreshold = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--cell-layout")) {
+                        options.cellLayout = value;
+                    } else if (!strcasecmp(argv[argi], "--cell-size")) {
+                        if (!strcasecmp(value, "auto")) {
+                            options.autoCellSize = true;
+                        } else {
+                            options.cellSizeFactor = atof(value);
+                            if (options.cellSizeFactor <= 0.0) {
+                                throw std::runtime_error("Cell size must be a positive factor or auto");
+                            }
+                        }
+                    } else if (!strcasecmp(argv[argi], "--neighbor-skin")) {
+                        options.neighborSkin = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--sleep-speed")) {
+                        options.sleepSpeed = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--sleep-delay")) {
+                        options.sleepDelay = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--restitution")) {
+                        options.restitution = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--contact-time")) {
+                        options.contactTime = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--max-events")) {
+                        options.maxEvents = atoi(value);
+                    } else if (!strcasecmp(argv[argi], "--max-seconds")) {
+                        options.maxSeconds = atof(value);
+                    } else if (!strcasecmp(argv[argi], "--storm-threshold")) {
+                        options.stormThreshold = atoi(value);
+                    } else if (!strcasecmp(argv[argi], "--queue")) {
+                        options.queueType = value;
+                    } else if (!strcasecmp(argv[argi], "--seeding")) {
+                        options.seeding = value;
+                    } else if (!strcasecmp(argv[argi], "--seed")) {
+                        options.seed = (unsigned int)(strtoul(value, 0, 10));
+                    } else {
+                        throw std::runtime_error(std::string("Unknown option ")+argv[argi]);
+                    }
+                    ++argi;
+                } else {
+                    throw std::runtime_error(std::string("Missing value for option ")+argv[argi]);
+                }
+            } else {
+                /* Unnamed parameter */
+                options.numParticles = atoi(argv[argi]);
+            }
+        }
+
+        /* Run the benchmark in the requested dimension: */
+        switch (options.dimension) {
+            case 2:
+                return runBenchmark<2>(options);
+
+            case 3:
+                return runBenchmark<3>(options);
+
+            default:
+                throw std::runtime_error("Dimension must be 2 or 3");
+        }
+    }
+    catch(const std::runtime_error& err)
+    {
+        /* Print error message: */
+        std::cerr<<"Caught exception "<<err.what()<<std::endl;
+
+        /* Signal error to OS: */
+        return 1;
+    }
+}
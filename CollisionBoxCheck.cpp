@@ -0,0 +1,761 @@
+/***********************************************************************
+CollisionBoxCheck - Headless program checking the behavior of the
+collision queues and the collision box on small fixed workloads; exits
+with a non-zero status if any check fails.
+***********************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <Math/Math.h>
+#include <Math/RandomEngine.h>
+
+#include "ParticleKernels.h"
+#include "CollisionQueue.h"
+#include "BarnesHutTree.h"
+#include "CollisionBox.h"
+
+namespace {
+
+/****************************************************
+Helper classes and functions for the collision queues:
+****************************************************/
+
+struct TestEvent // Queue element with a time as its only content
+{
+public:
+    /* Elements: */
+    double time;
+
+    /* Constructors and destructors: */
+    TestEvent(double sTime)
+        :time(sTime)
+    {
+    }
+
+    /* Methods: */
+    friend bool operator<=(const TestEvent& e1, const TestEvent& e2)
+    {
+        return e1.time <= e2.time;
+    }
+};
+
+struct TestEventKey // Class returning the sort key of test events in calendar queues
+{
+    static double getKey(const TestEvent& event)
+    {
+        return event.time;
+    }
+};
+
+typedef CollisionQueue<TestEvent, TestEventKey> TestQueue;
+typedef std::vector<std::pair<double, size_t> > PopSequence; // Absolute times and handles of the elements taken from a queue, in order
+
+PopSequence runQueueWorkload(TestQueue::Implementation implementation)
+{
+    /* Replace, remove, and pop random handles' elements over several windows, the way simulate() uses the queue: */
+    TestQueue queue;
+    size_t numHandles = 1000;
+    queue.setImplementation(implementation, numHandles);
+    Math::RandomEngine rng(17);
+    PopSequence result;
+    for (int window = 0; window < 20; ++window) {
+        queue.setWindow(0.0, 1.0);
+        double now = 0.0; // Time of the last popped element; new elements are never earlier
+        for (int op = 0; op < 20000; ++op) {
+            size_t handle = size_t(rng.uniformCO(0, int(numHandles)));
+            switch (rng.uniformCO(0, 4)) {
+                case 0:
+                case 1:
+                    /* Some elements fall beyond the window, and have to wait for the next one: */
+                    queue.replace(handle, TestEvent(now+rng.uniformCO(0.0, 1.5)));
+                    break;
+
+                case 2:
+                    if (queue.contains(handle)) {
+                        queue.remove(handle);
+                    }
+                    break;
+
+                default:
+                    if (!queue.isEmpty() && queue.getSmallest().time <= 1.0) {
+                        now = queue.getSmallest().time;
+                        result.push_back(std::make_pair(double(window)+now, queue.getSmallestHandle()));
+                        queue.remove(queue.getSmallestHandle());
+                    }
+            }
+        }
+
+        /* Empty the window, move the remaining elements into the next one, and add handles: */
+        while (!queue.isEmpty() && queue.getSmallest().time <= 1.0) {
+            result.push_back(std::make_pair(double(window)+queue.getSmallest().time, queue.getSmallestHandle()));
+            queue.remove(queue.getSmallestHandle());
+        }
+        auto rebaseFn = [](TestEvent& e) {
+            e.time -= 1.0;
+        };
+        queue.forEach(rebaseFn);
+        numHandles += 100;
+        queue.setNumHandles(numHandles);
+    }
+
+    return result;
+}
+
+/**************************************************
+Helper classes and functions for the collision box:
+**************************************************/
+
+typedef CollisionBox<double, 2> TestBox;
+typedef TestBox::Point Point;
+typedef TestBox::Vector Vector;
+
+const double particleRadius = 1.0;
+
+void createTestBox(TestBox& box, Math::RandomEngine& rng, double fillFraction, double speed)
+{
+    /* Place particles at random on a square grid of slightly wider than touching positions: */
+    const TestBox::Box& boundaries = box.getBoundaries();
+    double spacing = particleRadius*2.2;
+    for (double y = boundaries.min[1]+spacing*0.5; y+particleRadius < boundaries.max[1]; y += spacing) {
+        for (double x = boundaries.min[0]+spacing*0.5; x+particleRadius < boundaries.max[0]; x += spacing) {
+            if (rng.uniformCO() < fillFraction) {
+                Vector v;
+                rng.fillUniformCC(v.getComponents(), 2, -speed, speed);
+                box.addParticle(Point(x, y), v);
+            }
+        }
+    }
+
+    /* Stop the spherical obstacle outside the box: */
+    box.moveSphere(box.getSphere(), 1.0);
+}
+
+double calcKineticEnergy(const TestBox& box)
+{
+    double energy = 0.0;
+    auto addFn = [&energy](const TestBox::Particle& particle) {
+        energy += Geometry::sqr(particle.getVelocity())*0.5;
+    };
+    box.getParticles().forEach(addFn);
+    return energy;
+}
+
+void collectPositions(const TestBox& box, std::vector<Point>& handlePositions)
+{
+    /* Store each particle's position at its handle's index: */
+    auto collectFn = [&handlePositions](const TestBox::Particle& particle) {
+        if (handlePositions.size() <= particle.getHandle()) {
+            handlePositions.resize(particle.getHandle()+1);
+        }
+        handlePositions[particle.getHandle()] = particle.getPosition();
+    };
+    box.getParticles().forEach(collectFn);
+}
+
+bool checkPlacement(const TestBox& box, const char* checkName)
+{
+    /* Collect all particles' positions, and check that they are inside the box: */
+    const TestBox::Box& boundaries = box.getBoundaries();
+    std::vector<Point> positions;
+    bool inside = true;
+    auto collectFn = [&positions, &boundaries, &inside](const TestBox::Particle& particle) {
+        const Point& p = particle.getPosition();
+        for (int i = 0; i < 2; ++i) {
+            if (p[i] < boundaries.min[i]+particleRadius*0.999 || p[i] > boundaries.max[i]-particleRadius*0.999) {
+                inside = false;
+            }
+        }
+        positions.push_back(p);
+    };
+    box.getParticles().forEach(collectFn);
+    if (!inside) {
+        printf("%s: particle left the box\n", checkName);
+        return false;
+    }
+
+    /* Check that no two particles overlap: */
+    double minDist2 = Math::sqr(particleRadius*2.0*0.999);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        for (size_t j = i+1; j < positions.size(); ++j) {
+            if (Geometry::sqrDist(positions[i], positions[j]) < minDist2) {
+                printf("%s: particles overlap\n", checkName);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool compareTrajectories(TestBox& box0, TestBox& box1, int numSteps, const char* checkName)
+{
+    /* Fill both boxes from the same seed, and require identical positions and collision counts after every step: */
+    Math::RandomEngine rng0(71), rng1(71);
+    createTestBox(box0, rng0, 0.5, 4.0);
+    createTestBox(box1, rng1, 0.5, 4.0);
+    for (int step = 0; step < numSteps; ++step) {
+        box0.simulate(0.02);
+        box1.simulate(0.02);
+        std::vector<Point> positions0, positions1;
+        collectPositions(box0, positions0);
+        collectPositions(box1, positions1);
+        if (positions0 != positions1) {
+            printf("%s: trajectories differ after step %d\n", checkName, step);
+            return false;
+        }
+        if (box0.getEventCounts().numParticleCollisions != box1.getEventCounts().numParticleCollisions) {
+            printf("%s: collision counts differ after step %d\n", checkName, step);
+            return false;
+        }
+    }
+    if (TestBox::collectStats && box0.getEventCounts().numParticleCollisions == 0) {
+        printf("%s: particles did not collide\n", checkName);
+        return false;
+    }
+
+    return checkPlacement(box0, checkName);
+}
+
+/***************
+Check functions:
+***************/
+
+bool checkQueueOrder(void)
+{
+    /* All queue implementations must hand out the same elements in the same order: */
+    PopSequence heapOrder = runQueueWorkload(TestQueue::BinaryHeap);
+    if (heapOrder.size() < 5000) {
+        printf("queue order: binary heap popped only %lu elements\n", (unsigned long)heapOrder.size());
+        return false;
+    }
+    for (size_t i = 1; i < heapOrder.size(); ++i) {
+        if (heapOrder[i].first < heapOrder[i-1].first) {
+            printf("queue order: binary heap popped time %g after %g\n", heapOrder[i].first, heapOrder[i-1].first);
+            return false;
+        }
+    }
+    if (runQueueWorkload(TestQueue::DaryHeap) != heapOrder) {
+        printf("queue order: 4-ary heap differs from binary heap\n");
+        return false;
+    }
+    if (runQueueWorkload(TestQueue::Calendar) != heapOrder) {
+        printf("queue order: calendar queue differs from binary heap\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool checkHandleReuse(void)
+{
+    /* Run a source and a sink of particles with and without keeping the queue, and with neighbor lists: */
+    for (int mode = 0; mode < 3; ++mode) {
+        TestBox box(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+        box.setPersistentQueue(mode >= 1);
+        if (mode == 2) {
+            box.setNeighborSkin(0.5);
+        }
+        Math::RandomEngine rng(23+mode);
+        createTestBox(box, rng, 0.6, 4.0);
+        std::vector<TestBox::ParticleHandle> handles;
+        auto collectFn = [&handles](const TestBox::Particle& particle) {
+            handles.push_back(particle.getHandle());
+        };
+        box.getParticles().forEach(collectFn);
+        size_t numHandles = handles.size(); // Number of handles ever handed out
+
+        for (int step = 0; step < 200; ++step) {
+            /* Remove a few random particles, and check that their handles became invalid: */
+            std::vector<TestBox::ParticleHandle> freed;
+            for (int i = 0; i < 5; ++i) {
+                size_t index = size_t(rng.uniformCO(0, int(handles.size())));
+                freed.push_back(handles[index]);
+                handles[index] = handles.back();
+                handles.pop_back();
+                if (!box.removeParticle(freed.back())) {
+                    printf("handle reuse: could not remove a particle\n");
+                    return false;
+                }
+                if (box.removeParticle(freed.back())) {
+                    printf("handle reuse: removed a particle twice\n");
+                    return false;
+                }
+            }
+
+            /* Indexing the particle list must reach every slot, with the removed particles marked: */
+            TestBox::ParticleList particles = box.getParticles();
+            size_t numLive = 0;
+            for (size_t i = 0; i < particles.size(); ++i) {
+                if (!particles[i].isRemoved()) {
+                    ++numLive;
+                }
+            }
+            if (numLive != handles.size() || box.getNumParticles() != handles.size()) {
+                printf("handle reuse: particle list has %lu live particles instead of %lu\n", (unsigned long)numLive, (unsigned long)handles.size());
+                return false;
+            }
+
+            /* Add particles at random free positions, which must re-use the freed handles: */
+            const TestBox::Box& boundaries = box.getBoundaries();
+            for (int added = 0; added < 5; ) {
+                Point p;
+                Vector v;
+                for (int i = 0; i < 2; ++i) {
+                    p[i] = rng.uniformCC(boundaries.min[i]+particleRadius, boundaries.max[i]-particleRadius);
+                }
+                rng.fillUniformCC(v.getComponents(), 2, -4.0, 4.0);
+                TestBox::ParticleHandle handle;
+                if (box.addParticle(p, v, &handle)) {
+                    if (std::find(freed.begin(), freed.end(), handle) == freed.end()) {
+                        printf("handle reuse: new particle did not re-use a freed handle\n");
+                        return false;
+                    }
+                    handles.push_back(handle);
+                    ++added;
+                }
+            }
+
+            /* Simulate a step; collisions with removed particles would change the kinetic energy, or let particles overlap: */
+            double energy = calcKineticEnergy(box);
+            box.simulate(0.02);
+            if (Math::abs(calcKineticEnergy(box)-energy) > energy*1.0e-9) {
+                printf("handle reuse: kinetic energy changed from %g to %g\n", energy, calcKineticEnergy(box));
+                return false;
+            }
+            if (!checkPlacement(box, "handle reuse")) {
+                return false;
+            }
+        }
+
+        /* Check that each handle names its own particle, and that no handles were added: */
+        if (box.getNumParticles() != handles.size()) {
+            printf("handle reuse: box has %lu particles instead of %lu\n", (unsigned long)box.getNumParticles(), (unsigned long)handles.size());
+            return false;
+        }
+        std::vector<TestBox::ParticleHandle> boxHandles;
+        auto boxHandleFn = [&boxHandles](const TestBox::Particle& particle) {
+            boxHandles.push_back(particle.getHandle());
+        };
+        box.getParticles().forEach(boxHandleFn);
+        std::sort(boxHandles.begin(), boxHandles.end());
+        std::sort(handles.begin(), handles.end());
+        if (boxHandles != handles || handles.back() >= numHandles) {
+            printf("handle reuse: particle handles do not match the added particles\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool checkBatchAdd(void)
+{
+    /* Add the same overlapping batch at once and one by one to boxes that already hold particles and have free handles: */
+    for (int mode = 0; mode < 3; ++mode) {
+        std::vector<Point> batchPositions;
+        std::vector<Vector> batchVelocities;
+        std::vector<TestBox::ParticleHandle> handles[2];
+        TestBox* boxes[2];
+        for (int b = 0; b < 2; ++b) {
+            boxes[b] = new TestBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+            TestBox& box = *boxes[b];
+            box.setPersistentQueue(mode >= 1);
+            if (mode == 2) {
+                box.setNeighborSkin(0.5);
+            }
+            Math::RandomEngine rng(31+mode);
+            createTestBox(box, rng, 0.3, 4.0);
+            box.simulate(0.02);
+            for (TestBox::ParticleHandle handle = 0; handle < 40; handle += 4) {
+                box.removeParticle(handle);
+            }
+            if (b == 0) {
+                for (int i = 0; i < 200; ++i) {
+                    Point p;
+                    Vector v;
+                    rng.fillUniformCC(p.getComponents(), 2, particleRadius, 40.0-particleRadius);
+                    rng.fillUniformCC(v.getComponents(), 2, -4.0, 4.0);
+                    batchPositions.push_back(p);
+                    batchVelocities.push_back(v);
+                }
+                box.addParticles(batchPositions, batchVelocities, &handles[b]);
+            } else {
+                for (size_t i = 0; i < batchPositions.size(); ++i) {
+                    TestBox::ParticleHandle handle = TestBox::ParticleHandle(TestBox::noHandle);
+                    box.addParticle(batchPositions[i], batchVelocities[i], &handle);
+                    handles[b].push_back(handle);
+                }
+            }
+        }
+
+        /* Both boxes must accept the same particles, and simulate them the same way: */
+        bool passed = true;
+        size_t numAdded = 0;
+        for (size_t i = 0; i < batchPositions.size() && passed; ++i) {
+            if ((handles[0][i] == TestBox::noHandle) != (handles[1][i] == TestBox::noHandle)) {
+                printf("batch add: particle %lu accepted by only one box\n", (unsigned long)i);
+                passed = false;
+            } else if (handles[0][i] != TestBox::noHandle) {
+                ++numAdded;
+            }
+        }
+        if (passed && (numAdded == 0 || numAdded == batchPositions.size())) {
+            printf("batch add: %lu of %lu particles accepted\n", (unsigned long)numAdded, (unsigned long)batchPositions.size());
+            passed = false;
+        }
+        for (int step = 0; step < 20 && passed; ++step) {
+            boxes[0]->simulate(0.02);
+            boxes[1]->simulate(0.02);
+            passed = checkPlacement(*boxes[0], "batch add");
+        }
+        if (passed) {
+            std::vector<Point> handlePositions[2];
+            collectPositions(*boxes[0], handlePositions[0]);
+            collectPositions(*boxes[1], handlePositions[1]);
+            for (size_t i = 0; i < batchPositions.size() && passed; ++i) {
+                if (handles[0][i] != TestBox::noHandle && Geometry::dist(handlePositions[0][handles[0][i]], handlePositions[1][handles[1][i]]) > 1.0e-6) {
+                    printf("batch add: particle %lu moved differently after a batch add\n", (unsigned long)i);
+                    passed = false;
+                }
+            }
+        }
+        delete boxes[0];
+        delete boxes[1];
+        if (!passed) {
+            return false;
+        }
+    }
+
+    /* A batch with fewer velocities than positions must be rejected without adding particles: */
+    TestBox box(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    std::vector<Point> batchPositions(2, Point(10.0));
+    batchPositions[1][0] = 20.0;
+    std::vector<Vector> batchVelocities(1, Vector::zero);
+    try {
+        box.addParticles(batchPositions, batchVelocities);
+        printf("batch add: accepted a batch with missing velocities\n");
+        return false;
+    } catch (const std::runtime_error&) {
+    }
+    if (box.getNumParticles() != 0) {
+        printf("batch add: rejected batch added %lu particles\n", (unsigned long)box.getNumParticles());
+        return false;
+    }
+
+    return true;
+}
+
+bool checkStormGuard(void)
+{
+    /* Stack columns of resting particles on the floor under gravity, and stop steps at the first repeated collision: */
+    TestBox stackBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    stackBox.moveSphere(stackBox.getSphere(), 1.0);
+    Vector gravity = Vector::zero;
+    gravity[1] = -10.0;
+    stackBox.setLatentForce(gravity);
+    stackBox.setStormThreshold(1);
+    for (int column = 0; column < 5; ++column) {
+        for (int row = 0; row < 10; ++row) {
+            stackBox.addParticle(Point(5.0+double(column)*7.0, particleRadius+double(row)*particleRadius*2.0*(1.0+1.0e-9)), Vector::zero);
+        }
+    }
+
+    /* Let two particles bounce between each other and the walls such that they collide at almost the same time of every step: */
+    TestBox pairBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    pairBox.moveSphere(pairBox.getSphere(), 1.0);
+    pairBox.setStormThreshold(1);
+    double speed = (40.0-particleRadius*4.0)/0.01/(1.0+1.0e-8); // The particles collide every 0.01*(1+1e-8) time units
+    pairBox.addParticle(Point(10.0, 20.0), Vector(speed, 0.0));
+    pairBox.addParticle(Point(30.0, 20.0), Vector(-speed, 0.0));
+
+    /* Steps must not stop early, as neither box has collisions repeated within a millionth of a step: */
+    for (int step = 0; step < 100; ++step) {
+        if (stackBox.simulate(0.01) < 0.01) {
+            printf("storm guard: resting stack stopped step %d early\n", step);
+            return false;
+        }
+        if (pairBox.simulate(0.01) < 0.01) {
+            printf("storm guard: bouncing pair stopped step %d early\n", step);
+            return false;
+        }
+    }
+    if (TestBox::collectStats && (stackBox.getEventCounts().numParticleCollisions == 0 || pairBox.getEventCounts().numParticleCollisions < 90)) {
+        printf("storm guard: particles did not collide\n");
+        return false;
+    }
+
+    return checkPlacement(stackBox, "storm guard");
+}
+
+bool checkRestitution(void)
+{
+    /* Run a dense gas with elastic collisions after inelastic ones, with and without keeping the queue: */
+    for (int mode = 0; mode < 2; ++mode) {
+        TestBox box(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+        box.setPersistentQueue(mode == 1);
+        Math::RandomEngine rng(41+mode);
+        createTestBox(box, rng, 0.5, 4.0);
+
+        /* Inelastic collisions must lose energy: */
+        box.setRestitution(0.5, 1.0e-3);
+        double energy = calcKineticEnergy(box);
+        for (int step = 0; step < 20; ++step) {
+            box.simulate(0.02);
+        }
+        if (!(calcKineticEnergy(box) < energy*0.99)) {
+            printf("restitution: kinetic energy went from %g to %g at restitution 0.5\n", energy, calcKineticEnergy(box));
+            return false;
+        }
+
+        /* Elastic collisions must conserve energy, even though the particles still remember their last inelastic collisions' times: */
+        box.setRestitution(1.0, 1.0e-3);
+        energy = calcKineticEnergy(box);
+        size_t numCollisions = box.getEventCounts().numParticleCollisions;
+        for (int step = 0; step < 100; ++step) {
+            box.simulate(0.02);
+        }
+        if (Math::abs(calcKineticEnergy(box)-energy) > energy*1.0e-9) {
+            printf("restitution: kinetic energy went from %g to %g at restitution 1\n", energy, calcKineticEnergy(box));
+            return false;
+        }
+        if (TestBox::collectStats && box.getEventCounts().numParticleCollisions == numCollisions) {
+            printf("restitution: particles did not collide\n");
+            return false;
+        }
+        if (!checkPlacement(box, "restitution")) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool checkCellLayouts(void)
+{
+    /* Sorting the cells and particles along a Morton curve must not change how the particles move: */
+    TestBox rowMajorBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    TestBox mortonBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    mortonBox.setCellLayout(TestBox::MortonCells);
+    return compareTrajectories(rowMajorBox, mortonBox, 100, "cell layouts");
+}
+
+bool checkNeighborLists(void)
+{
+    /* Finding collision partners in neighbor lists instead of the grid cells must find the same collisions: */
+    TestBox gridBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    TestBox listBox(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    listBox.setNeighborSkin(0.5);
+    return compareTrajectories(gridBox, listBox, 100, "neighbor lists");
+}
+
+bool checkSleeping(void)
+{
+    /* Stack columns of particles at rest on the floor under weak gravity, which bounce by less than the sleep speed: */
+    TestBox box(TestBox::Box(Point(0.0), Point(40.0)), particleRadius, 5.0);
+    box.moveSphere(box.getSphere(), 1.0);
+    Vector gravity = Vector::zero;
+    gravity[1] = -0.1;
+    box.setLatentForce(gravity);
+    box.setSleeping(0.3, 0.05);
+    TestBox::ParticleHandle sleeper = TestBox::ParticleHandle(TestBox::noHandle); // Bottom particle of the first column
+    for (int column = 0; column < 5; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            TestBox::ParticleHandle handle = TestBox::ParticleHandle(TestBox::noHandle);
+            box.addParticle(Point(5.0+double(column)*7.0, particleRadius+double(row)*particleRadius*2.0*(1.0+1.0e-9)), Vector::zero, &handle);
+            if (column == 0 && row == 0) {
+                sleeper = handle;
+            }
+        }
+    }
+
+    /* The pile must go to sleep: */
+    for (int step = 0; step < 20; ++step) {
+        box.simulate(0.01);
+    }
+    if (box.getNumSleepingParticles() == 0) {
+        printf("sleeping: no particle of the resting pile was parked\n");
+        return false;
+    }
+    bool parked = false;
+    auto parkedFn = [sleeper, &parked](const TestBox::Particle& particle) {
+        if (particle.getHandle() == sleeper) {
+            parked = particle.isAsleep();
+        }
+    };
+    box.getParticles().forEach(parkedFn);
+    if (!parked) {
+        printf("sleeping: bottom particle of the pile was not parked\n");
+        return false;
+    }
+
+    /* Strike the parked bottom particle of the first column from the side; it must wake up and move away, and stay awake while it is fast: */
+    std::vector<Point> before;
+    collectPositions(box, before);
+    box.addParticle(Point(8.5, particleRadius), Vector(-20.0, 0.0));
+    for (int step = 0; step < 10; ++step) {
+        box.simulate(0.01);
+    }
+    box.getParticles().forEach(parkedFn);
+    if (parked) {
+        printf("sleeping: struck particle stayed parked\n");
+        return false;
+    }
+    std::vector<Point> after;
+    collectPositions(box, after);
+    if (after[sleeper][0] > before[sleeper][0]-0.1) {
+        printf("sleeping: struck particle did not move\n");
+        return false;
+    }
+
+    return checkPlacement(box, "sleeping");
+}
+
+template <int dimensionParam>
+bool checkGravityTreeDimension(void)
+{
+    typedef BarnesHutTree<double, dimensionParam> Tree;
+
+    /* Build a tree over a random cluster of bodies that is densest at its center: */
+    Math::RandomEngine rng(51+dimensionParam);
+    std::vector<typename Tree::Point> positions;
+    std::vector<double> masses;
+    typename Tree::Box bounds(typename Tree::Point(0.0), typename Tree::Point(40.0));
+    Tree tree;
+    tree.clear(bounds);
+    for (int i = 0; i < 300; ++i) {
+        typename Tree::Point p;
+        for (int j = 0; j < dimensionParam; ++j) {
+            p[j] = 20.0+(rng.uniformCC()+rng.uniformCC()+rng.uniformCC()-1.5)*12.0;
+        }
+        positions.push_back(p);
+        masses.push_back(rng.uniformCC(0.5, 2.0));
+        tree.insert(p, masses.back());
+    }
+
+    /* Compare the tree's accelerations against the direct sum over all other bodies: */
+    double maxExactError = 0.0; // Largest relative error at opening angle 0
+    double sumApproxError2 = 0.0, sumAccel2 = 0.0; // Sums of squared errors at opening angle 0.5 and of squared accelerations
+    for (size_t i = 0; i < positions.size(); ++i) {
+        typename Tree::Vector direct = Tree::Vector::zero;
+        for (size_t j = 0; j < positions.size(); ++j) {
+            if (j != i) {
+                typename Tree::Vector d = positions[i]-positions[j];
+                double dLen2 = Geometry::sqr(d);
+                direct -= d*(masses[j]/(dLen2*Math::sqrt(dLen2)));
+            }
+        }
+        double directLen = Geometry::mag(direct);
+        double exactError = Geometry::mag(tree.calcAcceleration(positions[i], 0.0)-direct)/directLen;
+        if (maxExactError < exactError) {
+            maxExactError = exactError;
+        }
+        sumApproxError2 += Geometry::sqr(tree.calcAcceleration(positions[i], 0.5)-direct);
+        sumAccel2 += Math::sqr(directLen);
+    }
+
+    /* Opening every node must give the direct sum up to rounding; an opening angle of 0.5 must stay within 1% RMS: */
+    if (maxExactError > 1.0e-10) {
+        printf("gravity tree: %dD relative error %g at opening angle 0\n", dimensionParam, maxExactError);
+        return false;
+    }
+    double approxError = Math::sqrt(sumApproxError2/sumAccel2);
+    if (approxError > 0.01) {
+        printf("gravity tree: %dD RMS relative error %g at opening angle 0.5\n", dimensionParam, approxError);
+        return false;
+    }
+
+    return true;
+}
+
+bool checkGravityTree(void)
+{
+    return checkGravityTreeDimension<2>() && checkGravityTreeDimension<3>();
+}
+
+template <class ScalarParam, int dimensionParam>
+bool checkKernelVariant(void)
+{
+    /* Fill two copies of random particle arrays whose length is not a multiple of any vector width: */
+    size_t numParticles = 1003;
+    size_t numComponents = numParticles*dimensionParam;
+    Math::RandomEngine rng(61+dimensionParam*sizeof(ScalarParam));
+    std::vector<ScalarParam> positions[2], velocities[2], timeStamps[2];
+    for (size_t i = 0; i < numComponents; ++i) {
+        positions[0].push_back(ScalarParam(rng.uniformCC(0.0, 100.0)));
+        velocities[0].push_back(ScalarParam(rng.uniformCC(-4.0, 4.0)));
+    }
+    for (size_t i = 0; i < numParticles; ++i) {
+        timeStamps[0].push_back(ScalarParam(rng.uniformCO(0.0, 0.01)));
+    }
+    positions[1] = positions[0];
+    velocities[1] = velocities[0];
+    timeStamps[1] = timeStamps[0];
+    ScalarParam latentForce[dimensionParam];
+    for (int j = 0; j < dimensionParam; ++j) {
+        latentForce[j] = ScalarParam(rng.uniformCC(-0.1, 0.1));
+    }
+
+    /* Advance one copy with the vectorized kernel and the other with the scalar template over a few steps: */
+    for (int step = 0; step < 3; ++step) {
+        ParticleKernels::advance<ScalarParam, dimensionParam>(numParticles, positions[0].data(), velocities[0].data(), timeStamps[0].data(), ScalarParam(0.01), ScalarParam(0.999), latentForce, ScalarParam(0.003));
+        ParticleKernels::advanceScalar<ScalarParam, dimensionParam>(numParticles, positions[1].data(), velocities[1].data(), timeStamps[1].data(), ScalarParam(0.01), ScalarParam(0.999), latentForce, ScalarParam(0.003));
+    }
+
+    /* Both copies must be identical bit for bit: */
+    if (memcmp(positions[0].data(), positions[1].data(), numComponents*sizeof(ScalarParam)) != 0 ||
+        memcmp(velocities[0].data(), velocities[1].data(), numComponents*sizeof(ScalarParam)) != 0 ||
+        memcmp(timeStamps[0].data(), timeStamps[1].data(), numParticles*sizeof(ScalarParam)) != 0) {
+        printf("particle kernels: %s %dD kernel (%s) differs from the scalar template\n", sizeof(ScalarParam) == sizeof(float) ? "float" : "double", dimensionParam, ParticleKernels::getInstructionSet());
+        return false;
+    }
+
+    return true;
+}
+
+bool checkParticleKernels(void)
+{
+    return checkKernelVariant<float, 2>() && checkKernelVariant<float, 3>() && checkKernelVariant<double, 2>() && checkKernelVariant<double, 3>();
+}
+
+}
+
+int main(void)
+{
+    /* Run all checks and report each one's result: */
+    struct Check
+    {
+        const char* name;
+        bool (*function)(void);
+    };
+    static const Check checks[] = {
+        {"queue order", checkQueueOrder},
+        {"handle reuse", checkHandleReuse},
+        {"batch add", checkBatchAdd},
+        {"storm guard", checkStormGuard},
+        {"restitution", checkRestitution},
+        {"cell layouts", checkCellLayouts},
+        {"neighbor lists", checkNeighborLists},
+        {"sleeping", checkSleeping},
+        {"gravity tree", checkGravityTree},
+        {"particle kernels", checkParticleKernels}
+    };
+    int numFailed = 0;
+    for (size_t i = 0; i < sizeof(checks)/sizeof(Check); ++i) {
+        bool passed = checks[i].function();
+        printf("%-40s %s\n", checks[i].name, passed ? "passed" : "FAILED");
+        if (!passed) {
+            ++numFailed;
+        }
+    }
+
+    if (numFailed > 0) {
+        printf("%d checks failed\n", numFailed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
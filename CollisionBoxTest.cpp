@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 ***********************************************************************/
 
 #include <cstdlib>
+#include <string>
+#include <vector>
 #include <stdexcept>
 #include <iostream>
 #include <strings.h>
@@ -27,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Math/Math.h>
 #include <Math/Constants.h>
 #include <Math/Random.h>
+#include <Math/RandomEngine.h>
 #include <Geometry/Point.h>
 #include <Geometry/Vector.h>
 #include <GL/gl.h>
@@ -34,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <GL/GLGeometryWrappers.h>
 
 #include "GlutApplication.h"
+#include "ParticleSeeding.h"
 #include "CollisionBox.h"
 
 class CollisionBoxTest : public GlutApplication
@@ -101,6 +105,9 @@ CollisionBoxTest::CollisionBoxTest(int& argc, char**& argv)
     Scalar speedRange = 4.0;
     bool stopped = false;
     bool particleGravity = false;
+    Scalar openingAngle = 0.5;
+    int numThreads = 1;
+    std::string seeding = "random";
     for (int argi = 1; argi < argc; ++argi) {
         if (argv[argi][0] == '-') {
             /* Parameters with values */
@@ -121,6 +128,12 @@ CollisionBoxTest::CollisionBoxTest(int& argc, char**& argv)
                     friction = atof(argv[argi+1]);
                 } else if (!strcasecmp(argv[argi], "--speedrange")) {
                     speedRange = atof(argv[argi+1]);
+                } else if (!strcasecmp(argv[argi], "--opening-angle")) {
+                    openingAngle = atof(argv[argi+1]);
+                } else if (!strcasecmp(argv[argi], "--threads")) {
+                    numThreads = atoi(argv[argi+1]);
+                } else if (!strcasecmp(argv[argi], "--seeding")) {
+                    seeding = argv[argi+1];
                 }
                 ++argi;
             }
@@ -145,36 +158,54 @@ CollisionBoxTest::CollisionBoxTest(int& argc, char**& argv)
     collisionBox->setLatentForce(latentForce);
     collisionBox->setFriction(friction);
     collisionBox->setIntraParticleGravitation(particleGravity);
+    collisionBox->setGravitationOpeningAngle(openingAngle);
+    collisionBox->setNumThreads(numThreads);
+    collisionBox->setStormThreshold(1000); // Keep the display responsive if particles get stuck in an event storm
     spherePosition = collisionBox->getSphere();
 
-    std::srand(std::time(NULL));
+    Math::seedRandom(uint64_t(std::time(NULL)));
     
     /* Create a few particles: */
     const Box& boundaries = collisionBox->getBoundaries();
     int particleIndex;
-    for (particleIndex = 0; particleIndex < numParticles; ++particleIndex) {
-        const int maxNumTries = 200;
-        int tries;
-        for (tries = 0; tries < maxNumTries; ++tries) {
-            Point p;
-            Vector v;
-            for (int j = 0; j < MyCollisionBox::dimension; ++j) {
-                p[j] = Math::randUniformCC(boundaries.min[j]+Scalar(1), 
-                                           boundaries.max[j]-boundaries.min[j]-Scalar(2));
-                if (!stopped) {
-                    v[j] = Scalar(Math::randUniformCC(-speedRange, speedRange));
+    if (!strcasecmp(seeding.c_str(), "lattice") || !strcasecmp(seeding.c_str(), "poisson")) {
+        /* Generate non-overlapping positions spread over the box, and add them at once: */
+        std::vector<Point> positions;
+        ParticleSeeding::generatePositions(boundaries, particleRadius, size_t(numParticles), !strcasecmp(seeding.c_str(), "lattice") ? ParticleSeeding::Lattice : ParticleSeeding::PoissonDisk, positions);
+        std::vector<Vector> velocities(positions.size(), Vector::zero);
+        if (!stopped) {
+            for (std::vector<Vector>::iterator vIt = velocities.begin(); vIt != velocities.end(); ++vIt) {
+                for (int j = 0; j < MyCollisionBox::dimension; ++j) {
+                    (*vIt)[j] = Scalar(Math::randUniformCC(-speedRange, speedRange));
+                }
+            }
+        }
+        particleIndex = int(collisionBox->addParticles(positions, velocities));
+    } else {
+        for (particleIndex = 0; particleIndex < numParticles; ++particleIndex) {
+            const int maxNumTries = 200;
+            int tries;
+            for (tries = 0; tries < maxNumTries; ++tries) {
+                Point p;
+                Vector v;
+                for (int j = 0; j < MyCollisionBox::dimension; ++j) {
+                    p[j] = Math::randUniformCC(boundaries.min[j]+Scalar(1), 
+                                               boundaries.max[j]-boundaries.min[j]-Scalar(2));
+                    if (!stopped) {
+                        v[j] = Scalar(Math::randUniformCC(-speedRange, speedRange));
+                    }
+                }
+                
+                /* Try adding the new particle: */
+                if (collisionBox->addParticle(p, v)) {
+                    break;
                 }
             }
             
-            /* Try adding the new particle: */
-            if (collisionBox->addParticle(p, v)) {
+            if (tries == maxNumTries) { // Could not add particles after N tries; assume box is full
                 break;
             }
         }
-        
-        if (tries == maxNumTries) { // Could not add particles after N tries; assume box is full
-            break;
-        }
     }
     
     if (particleIndex < numParticles) {
@@ -334,14 +365,21 @@ void CollisionBoxTest::idle(void)
         collisionBox->setAttenuation(Scalar(0.9));
     }
     collisionBox->moveSphere(spherePosition, 0.1);
-    collisionBox->simulate(timeStep);
+    collisionBox->simulate(timeStep, 0, 0.05); // Drop the rest of the frame's time step if simulating it takes too long
     lastApplicationTime = newApplicationTime;
     glutPostRedisplay();
 
     if (showFps) {
         if (++frameCounter >= frameCountMax) {
             double fps = frameCounter/(newApplicationTime - frameTimer);
-            std::cout << fps << std::endl;
+            std::cout << fps;
+            
+            /* Break down the last step's simulation time by phase: */
+            const Misc::RegionTimers& stepTimers = collisionBox->getStepTimers();
+            for (int region = 0; region < stepTimers.getNumRegions(); ++region) {
+                std::cout << ' ' << stepTimers.getRegionName(region) << ' ' << stepTimers.getLastFrameTime(region)*1000.0 << "ms";
+            }
+            std::cout << std::endl;
             frameCounter = 0;
             frameTimer = newApplicationTime;
         }
@@ -0,0 +1,247 @@
+/***********************************************************************
+CollisionQueue - Class for indexed priority queues of collision events
+that are implemented as a binary heap, a cache-aligned 4-ary heap, or a
+calendar queue, selected at run time. Only the selected data structure
+is allocated. Elements are associated with integer handles and can be
+replaced or removed by handle.
+***********************************************************************/
+
+#ifndef COLLISIONQUEUE_INCLUDED
+#define COLLISIONQUEUE_INCLUDED
+
+#include <stddef.h>
+#include <Misc/IndexedPriorityHeap.h>
+#include <Misc/IndexedDaryHeap.h>
+#include <Misc/IndexedCalendarQueue.h>
+
+template <class ContentParam, class KeyParam>
+class CollisionQueue
+{
+public:
+    /* Embedded classes: */
+    typedef ContentParam Content; // Data type for queue elements; must provide operator<=
+    typedef KeyParam Key; // Class providing static double getKey(const Content&) for calendar queues
+
+    enum Implementation // Data structures implementing the queue
+    {
+        BinaryHeap, DaryHeap, Calendar
+    };
+
+private:
+    /* Elements: */
+    Implementation implementation; // Data structure currently holding the queue's elements
+    Misc::IndexedPriorityHeap<Content>* heap; // Binary heap, or null if another data structure is selected
+    Misc::IndexedDaryHeap<Content, 4>* daryHeap; // 4-ary heap, or null if another data structure is selected
+    Misc::IndexedCalendarQueue<Content, Key>* calendar; // Calendar queue, or null if another data structure is selected
+
+    /* Constructors and destructors: */
+public:
+    CollisionQueue(void) // Creates an empty binary heap queue without valid handles
+        :implementation(BinaryHeap),
+         heap(new Misc::IndexedPriorityHeap<Content>), daryHeap(0), calendar(0)
+    {
+    }
+private:
+    CollisionQueue(const CollisionQueue& source); // Prohibit copy constructor
+    CollisionQueue& operator=(const CollisionQueue& source); // Prohibit assignment operator
+public:
+    ~CollisionQueue(void)
+    {
+        delete heap;
+        delete daryHeap;
+        delete calendar;
+    }
+
+    /* Methods: */
+    Implementation getImplementation(void) const // Returns the data structure implementing the queue
+    {
+        return implementation;
+    }
+    void setImplementation(Implementation newImplementation, size_t numHandles) // Replaces the data structure implementing the queue by an empty one of the given type for the given number of handles
+    {
+        delete heap;
+        delete daryHeap;
+        delete calendar;
+        heap=0;
+        daryHeap=0;
+        calendar=0;
+        implementation=newImplementation;
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap=new Misc::IndexedDaryHeap<Content, 4>(numHandles);
+                break;
+            case Calendar:
+                calendar=new Misc::IndexedCalendarQueue<Content, Key>(numHandles);
+                break;
+            default:
+                heap=new Misc::IndexedPriorityHeap<Content>(numHandles);
+        }
+    }
+    void setNumHandles(size_t newNumHandles) // Changes the number of valid handles
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->setNumHandles(newNumHandles);
+                break;
+            case Calendar:
+                calendar->setNumHandles(newNumHandles);
+                break;
+            default:
+                heap->setNumHandles(newNumHandles);
+        }
+    }
+    void reserve(size_t newCapacity) // Makes room for the given number of elements so that the queue does not reallocate while filling up
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->reserve(newCapacity);
+                break;
+            case Calendar:
+                break; // The calendar queue stores elements per handle
+            default:
+                heap->reserve(newCapacity);
+        }
+    }
+    void setWindow(double windowBegin, double windowEnd) // Announces the key range of the elements that will be removed next; must be called after forEach() changed any keys
+    {
+        if (implementation==Calendar)
+            calendar->setWindow(windowBegin,windowEnd);
+    }
+    bool isEmpty(void) const
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                return daryHeap->isEmpty();
+            case Calendar:
+                return calendar->isEmpty();
+            default:
+                return heap->isEmpty();
+        }
+    }
+    size_t getNumElements(void) const
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                return daryHeap->getNumElements();
+            case Calendar:
+                return calendar->getNumElements();
+            default:
+                return heap->getNumElements();
+        }
+    }
+    void clear(void)
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->clear();
+                break;
+            case Calendar:
+                calendar->clear();
+                break;
+            default:
+                heap->clear();
+        }
+    }
+    bool contains(size_t handle) const
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                return daryHeap->contains(handle);
+            case Calendar:
+                return calendar->contains(handle);
+            default:
+                return heap->contains(handle);
+        }
+    }
+    void replace(size_t handle, const Content& newElement) // Replaces the element associated with the given handle, or inserts a new element if there is none
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->replace(handle,newElement);
+                break;
+            case Calendar:
+                calendar->replace(handle,newElement);
+                break;
+            default:
+                heap->replace(handle,newElement);
+        }
+    }
+    void remove(size_t handle)
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->remove(handle);
+                break;
+            case Calendar:
+                calendar->remove(handle);
+                break;
+            default:
+                heap->remove(handle);
+        }
+    }
+    const Content& getSmallest(void) const
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                return daryHeap->getSmallest();
+            case Calendar:
+                return calendar->getSmallest();
+            default:
+                return heap->getSmallest();
+        }
+    }
+    size_t getSmallestHandle(void) const
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                return daryHeap->getSmallestHandle();
+            case Calendar:
+                return calendar->getSmallestHandle();
+            default:
+                return heap->getSmallestHandle();
+        }
+    }
+    template <class FunctorParam>
+    void forEach(FunctorParam& functor) // Applies given functor to each element in unspecified order
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->forEach(functor);
+                break;
+            case Calendar:
+                calendar->forEach(functor);
+                break;
+            default:
+                heap->forEach(functor);
+        }
+    }
+    template <class FunctorParam>
+    void renumberHandles(FunctorParam& functor) // Associates each element with the handle returned by functor(oldHandle)
+    {
+        switch (implementation)
+        {
+            case DaryHeap:
+                daryHeap->renumberHandles(functor);
+                break;
+            case Calendar:
+                calendar->renumberHandles(functor);
+                break;
+            default:
+                heap->renumberHandles(functor);
+        }
+    }
+};
+
+#endif
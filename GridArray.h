@@ -0,0 +1,130 @@
+/***********************************************************************
+GridArray - Class for multidimensional arrays of grid cells that are laid
+out in memory either in row-major order, or along a Morton (Z-order)
+curve inside blocks of 8^d cells with the blocks in row-major order.
+Both layouts are separable, so an element's linear index is the sum of
+one table entry per index component.
+***********************************************************************/
+
+#ifndef GRIDARRAY_INCLUDED
+#define GRIDARRAY_INCLUDED
+
+#include <stddef.h>
+#include <Misc/ArrayIndex.h>
+
+#include <vector>
+
+template <class ContentParam, int dimensionParam>
+class GridArray
+{
+public:
+    /* Embedded classes: */
+    typedef ContentParam Content; // Data type for array elements
+    static const int dimension=dimensionParam; // Dimension of the array
+    typedef Misc::ArrayIndex<dimensionParam> Index; // Data type for element indices
+
+    enum Layout // Memory layouts of the array's elements
+    {
+        RowMajor, Morton
+    };
+
+    static const int blockBits=3; // Binary logarithm of the edge length of the blocks laid out along a Morton curve
+
+private:
+    /* Elements: */
+    Index size; // Size of the array
+    Layout layout; // Memory layout of the array's elements
+    std::vector<ptrdiff_t> offsets[dimensionParam]; // Contribution of each index component value to an element's linear index
+    std::vector<Content> elements; // Array elements, including padding to whole blocks in Morton layout
+
+    /* Constructors and destructors: */
+public:
+    GridArray(void) // Creates an empty array
+        :size(0), layout(RowMajor)
+    {
+    }
+
+    /* Methods: */
+    void resize(const Index& newSize, Layout newLayout) // Resizes the array and re-initializes all elements
+    {
+        size=newSize;
+        layout=newLayout;
+
+        ptrdiff_t numElements=1;
+        if (layout==Morton)
+        {
+            /* Pad the array to whole blocks, and interleave the bits of the index components inside each block: */
+            numElements=ptrdiff_t(1)<<(blockBits*dimension);
+            for (int i=dimension-1;i>=0;--i)
+            {
+                offsets[i].resize(size[i]);
+                for (int x=0;x<size[i];++x)
+                {
+                    ptrdiff_t blockOffset=0;
+                    for (int bit=0;bit<blockBits;++bit)
+                        if (x&(1<<bit))
+                            blockOffset|=ptrdiff_t(1)<<(bit*dimension+dimension-1-i);
+                    offsets[i][x]=ptrdiff_t(x>>blockBits)*numElements+blockOffset;
+                }
+                numElements*=(size[i]+(1<<blockBits)-1)>>blockBits;
+            }
+        }
+        else
+        {
+            /* Let the last index component vary fastest: */
+            for (int i=dimension-1;i>=0;--i)
+            {
+                offsets[i].resize(size[i]);
+                for (int x=0;x<size[i];++x)
+                    offsets[i][x]=ptrdiff_t(x)*numElements;
+                numElements*=size[i];
+            }
+        }
+
+        elements.assign(numElements,Content());
+    }
+    const Index& getSize(void) const // Returns the size of the array
+    {
+        return size;
+    }
+    Layout getLayout(void) const // Returns the array's memory layout
+    {
+        return layout;
+    }
+    size_t getNumElements(void) const // Returns the number of allocated elements, including padding
+    {
+        return elements.size();
+    }
+    Content* getArray(void) // Returns the allocated elements in memory order
+    {
+        return &elements[0];
+    }
+    ptrdiff_t calcLinearIndex(const Index& index) const // Returns the position of an element in memory order
+    {
+        ptrdiff_t result=offsets[0][index[0]];
+        for (int i=1;i<dimension;++i)
+            result+=offsets[i][index[i]];
+        return result;
+    }
+    ptrdiff_t calcLinearIndex(const Index& index, const Index& delta) const // Returns the position of the element at the given offset from the given index
+    {
+        ptrdiff_t result=offsets[0][index[0]+delta[0]];
+        for (int i=1;i<dimension;++i)
+            result+=offsets[i][index[i]+delta[i]];
+        return result;
+    }
+    Content* getAddress(const Index& index) // Returns a pointer to an element
+    {
+        return &elements[calcLinearIndex(index)];
+    }
+    Content* getAddress(const Index& index, const Index& delta) // Returns a pointer to the element at the given offset from the given index
+    {
+        return &elements[calcLinearIndex(index,delta)];
+    }
+    Content& operator()(const Index& index) // Accesses an element
+    {
+        return elements[calcLinearIndex(index)];
+    }
+};
+
+#endif
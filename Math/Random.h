@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 namespace Math {
 
+/* All functions draw from the calling thread's RandomEngine; see seedRandom(): */
+
 double randUniformCO(void); // Uniform distribution in interval [0,1)
 double randUniformCC(void); // Uniform distribution in interval [0,1]
 int randUniformCO(int min,int max); // Uniform distribution in interval [min,max)
@@ -0,0 +1,188 @@
+/***********************************************************************
+RandomEngine - Class for fast pseudo-random number generators based on
+the xoshiro256** algorithm, with explicit seeding, independent streams
+for multiple threads, and samplers for uniform and normal distributions.
+***********************************************************************/
+
+#include <math.h>
+#include <atomic>
+
+#include <Math/RandomEngine.h>
+
+namespace Math {
+
+namespace {
+
+/**************************************************************
+Tables for the 128-layer Ziggurat of the standard normal
+distribution, following Marsaglia and Tsang, and Doornik's
+variant that needs only one uniform number in the common case:
+**************************************************************/
+
+const int zigguratNumLayers=128;
+const double zigguratR=3.442619855899; // Start of the distribution's tail
+const double zigguratV=9.91256303526217e-3; // Area of each layer
+
+struct ZigguratTables
+	{
+	/* Elements: */
+	public:
+	double x[zigguratNumLayers+1]; // Right edges of the layers
+	double ratio[zigguratNumLayers]; // Ratio of each layer's width to the width of the layer below it
+
+	/* Constructors and destructors: */
+	ZigguratTables(void)
+		{
+		double f=exp(-0.5*zigguratR*zigguratR);
+		x[0]=zigguratV/f;
+		x[1]=zigguratR;
+		x[zigguratNumLayers]=0.0;
+		for(int i=2;i<zigguratNumLayers;++i)
+			{
+			x[i]=sqrt(-2.0*log(zigguratV/x[i-1]+f));
+			f=exp(-0.5*x[i]*x[i]);
+			}
+		for(int i=0;i<zigguratNumLayers;++i)
+			ratio[i]=x[i+1]/x[i];
+		}
+	};
+
+const ZigguratTables ziggurat;
+
+/****************************************************
+State shared by the generators of different threads:
+****************************************************/
+
+std::atomic<uint64_t> threadBaseSeed(RandomEngine::defaultSeed); // Seed for generators of threads that have not used theirs yet
+std::atomic<unsigned int> numThreadEngines(0); // Number of threads that have used their generators
+
+struct ThreadEngine
+	{
+	/* Elements: */
+	public:
+	unsigned int ordinal; // Order in which the owning thread first used its generator
+	RandomEngine engine;
+
+	/* Constructors and destructors: */
+	ThreadEngine(void)
+		:ordinal(numThreadEngines++)
+		{
+		reseed(threadBaseSeed);
+		}
+
+	/* Methods: */
+	void reseed(uint64_t seed)
+		{
+		/* Give each thread its own non-overlapping part of the seed's sequence: */
+		engine.seed(seed);
+		for(unsigned int i=0;i<ordinal;++i)
+			engine.jump();
+		}
+	};
+
+ThreadEngine& getThreadEngine(void)
+	{
+	static thread_local ThreadEngine threadEngine;
+	return threadEngine;
+	}
+
+}
+
+/*************************************
+Static members of class RandomEngine:
+*************************************/
+
+const uint64_t RandomEngine::defaultSeed;
+
+/******************************
+Methods of class RandomEngine:
+******************************/
+
+double RandomEngine::normalTail(bool negative)
+	{
+	double x,y;
+	do
+		{
+		x=log(uniformOO())/zigguratR;
+		y=log(uniformOO());
+		}
+	while(-2.0*y<x*x);
+	return negative?x-zigguratR:zigguratR-x;
+	}
+
+void RandomEngine::seed(uint64_t newSeed)
+	{
+	/* Expand the seed into the full state with the splitmix64 generator, which never produces an all-zero state: */
+	uint64_t s=newSeed;
+	for(int i=0;i<4;++i)
+		{
+		s+=0x9e3779b97f4a7c15ULL;
+		uint64_t z=s;
+		z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+		z=(z^(z>>27))*0x94d049bb133111ebULL;
+		state[i]=z^(z>>31);
+		}
+	}
+
+void RandomEngine::jump(void)
+	{
+	static const uint64_t jumpPolynomial[4]=
+		{
+		0x180ec6d33cfd0abaULL,0xd5a61266f0c9392cULL,0xa9582618e03fc9aaULL,0x39abdc4529b1661cULL
+		};
+
+	uint64_t newState[4]={0,0,0,0};
+	for(int i=0;i<4;++i)
+		for(int b=0;b<64;++b)
+			{
+			if(jumpPolynomial[i]&(uint64_t(1)<<b))
+				for(int j=0;j<4;++j)
+					newState[j]^=state[j];
+			(*this)();
+			}
+	for(int j=0;j<4;++j)
+		state[j]=newState[j];
+	}
+
+double RandomEngine::normal(void)
+	{
+	while(true)
+		{
+		/* Draw a layer index and a signed position inside the layer from the same random number: */
+		uint64_t bits=(*this)();
+		int layer=int(bits&(zigguratNumLayers-1));
+		double u=double(bits>>11)*(2.0/9007199254740992.0)-1.0;
+
+		/* Accept the position immediately if it lies inside the layer above: */
+		if(fabs(u)<ziggurat.ratio[layer])
+			return u*ziggurat.x[layer];
+
+		/* Sample the tail for the base layer: */
+		if(layer==0)
+			return normalTail(u<0.0);
+
+		/* Accept the position if it lies under the density function: */
+		double x=u*ziggurat.x[layer];
+		double f0=exp(-0.5*(ziggurat.x[layer]*ziggurat.x[layer]-x*x));
+		double f1=exp(-0.5*(ziggurat.x[layer+1]*ziggurat.x[layer+1]-x*x));
+		if(f1+uniformCO()*(f0-f1)<1.0)
+			return x;
+		}
+	}
+
+/*****************
+Global functions:
+*****************/
+
+RandomEngine& getThreadRandomEngine(void)
+	{
+	return getThreadEngine().engine;
+	}
+
+void seedRandom(uint64_t seed)
+	{
+	threadBaseSeed=seed;
+	getThreadEngine().reseed(seed);
+	}
+
+}
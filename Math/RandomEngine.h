@@ -0,0 +1,132 @@
+/***********************************************************************
+RandomEngine - Class for fast pseudo-random number generators based on
+the xoshiro256** algorithm, with explicit seeding, independent streams
+for multiple threads, and samplers for uniform and normal distributions.
+***********************************************************************/
+
+#ifndef MATH_RANDOMENGINE_INCLUDED
+#define MATH_RANDOMENGINE_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Math {
+
+class RandomEngine
+	{
+	/* Embedded classes: */
+	public:
+	typedef uint64_t result_type; // Type of raw random numbers; the engine models a C++11 uniform random bit generator
+	static const uint64_t defaultSeed=1; // Seed used by the default constructor
+
+	/* Elements: */
+	private:
+	uint64_t state[4]; // Generator state; never all zero
+
+	/* Private methods: */
+	static uint64_t rotl(uint64_t x,int k)
+		{
+		return (x<<k)|(x>>(64-k));
+		}
+	double normalTail(bool negative); // Samples the tail of the standard normal distribution beyond the Ziggurat's base layer
+
+	/* Constructors and destructors: */
+	public:
+	RandomEngine(uint64_t sSeed =defaultSeed) // Creates a generator with the given seed
+		{
+		seed(sSeed);
+		}
+
+	/* Methods: */
+	void seed(uint64_t newSeed); // Resets the generator to the sequence belonging to the given seed
+	void jump(void); // Advances the generator by 2^128 numbers; generators jumped by different counts from the same seed produce non-overlapping sequences
+	static result_type min(void)
+		{
+		return 0;
+		}
+	static result_type max(void)
+		{
+		return ~uint64_t(0);
+		}
+	result_type operator()(void) // Returns the next uniformly distributed 64-bit number
+		{
+		uint64_t result=rotl(state[1]*5,7)*9;
+		uint64_t t=state[1]<<17;
+		state[2]^=state[0];
+		state[3]^=state[1];
+		state[1]^=state[2];
+		state[0]^=state[3];
+		state[2]^=t;
+		state[3]=rotl(state[3],45);
+		return result;
+		}
+	double uniformCO(void) // Uniform distribution in interval [0,1)
+		{
+		return double((*this)()>>11)*(1.0/9007199254740992.0);
+		}
+	double uniformCC(void) // Uniform distribution in interval [0,1]
+		{
+		return double((*this)()>>11)*(1.0/9007199254740991.0);
+		}
+	double uniformOO(void) // Uniform distribution in interval (0,1)
+		{
+		return (double((*this)()>>12)+0.5)*(1.0/4503599627370496.0);
+		}
+	double uniformCO(double min,double max) // Uniform distribution in interval [min,max)
+		{
+		return uniformCO()*(max-min)+min;
+		}
+	double uniformCC(double min,double max) // Uniform distribution in interval [min,max]
+		{
+		return uniformCC()*(max-min)+min;
+		}
+	int uniformCO(int min,int max) // Uniform distribution in interval [min,max), without modulo bias
+		{
+		/* Scale a 32-bit number into the interval, rejecting the few numbers that would favor some results (Lemire's method): */
+		uint32_t range=uint32_t(max-min);
+		uint64_t product=uint64_t(uint32_t((*this)()>>32))*range;
+		if(uint32_t(product)<range)
+			{
+			uint32_t threshold=uint32_t(-range)%range;
+			while(uint32_t(product)<threshold)
+				product=uint64_t(uint32_t((*this)()>>32))*range;
+			}
+		return min+int(product>>32);
+		}
+	int uniformCC(int min,int max) // Uniform distribution in interval [min,max]
+		{
+		return uniformCO(min,max+1);
+		}
+	double normal(void); // Standard normal distribution, sampled with a 128-layer Ziggurat
+	double normal(double mean,double stddev) // Normal distribution with mean and standard deviation
+		{
+		return normal()*stddev+mean;
+		}
+	template <class ScalarParam>
+	void fillUniformCO(ScalarParam* values,size_t numValues,double min,double max) // Fills the given array with values of a uniform distribution in interval [min,max)
+		{
+		double scale=(max-min)*(1.0/9007199254740992.0);
+		for(size_t i=0;i<numValues;++i)
+			values[i]=ScalarParam(double((*this)()>>11)*scale+min);
+		}
+	template <class ScalarParam>
+	void fillUniformCC(ScalarParam* values,size_t numValues,double min,double max) // Fills the given array with values of a uniform distribution in interval [min,max]
+		{
+		double scale=(max-min)*(1.0/9007199254740991.0);
+		for(size_t i=0;i<numValues;++i)
+			values[i]=ScalarParam(double((*this)()>>11)*scale+min);
+		}
+	template <class ScalarParam>
+	void fillNormal(ScalarParam* values,size_t numValues,double mean,double stddev) // Fills the given array with values of a normal distribution
+		{
+		for(size_t i=0;i<numValues;++i)
+			values[i]=ScalarParam(normal()*stddev+mean);
+		}
+	};
+
+RandomEngine& getThreadRandomEngine(void); // Returns the calling thread's generator; each thread's generator is seeded by the most recent seedRandom() call and jumped by the order in which threads first used their generators
+void seedRandom(uint64_t seed); // Re-seeds the calling thread's generator and the generators of threads that have not used theirs yet
+
+}
+
+#endif
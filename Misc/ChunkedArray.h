@@ -1,6 +1,7 @@
 /***********************************************************************
 ChunkedArray - Data structure to store lists of elements in page-aligned
-chunks of memory.
+chunks of memory. All chunks but the last are full, such that elements
+can be accessed by index in constant time.
 Copyright (c) 2005 Oliver Kreylos
 
 This file is part of the Miscellaneous Support Library (Misc).
@@ -26,6 +27,7 @@ Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <stddef.h>
 #include <new>
+#include <vector>
 
 namespace Misc {
 
@@ -226,11 +228,13 @@ class ChunkedArray
 	private:
 	Chunk* firstChunk; // Pointer to first chunk in list
 	Chunk* lastChunk; // Pointer to last chunk in list
+	std::vector<Chunk*> chunks; // Table of all chunks in list order
+	size_t numElements; // Total number of elements in all chunks
 	
 	/* Constructors and destructors: */
 	public:
 	ChunkedArray(void) // Creates empty array
-		:firstChunk(0),lastChunk(0)
+		:firstChunk(0),lastChunk(0),numElements(0)
 		{
 		}
 	private:
@@ -249,10 +253,15 @@ class ChunkedArray
 		}
 	size_t size(void) const // Returns total number of elements in chunked array
 		{
-		size_t result=0;
-		for(const Chunk* chPtr=firstChunk;chPtr!=0;chPtr=chPtr->header.succ)
-			result+=chPtr->header.numElements;
-		return result;
+		return numElements;
+		}
+	const Content& operator[](size_t index) const // Returns reference to the element of the given index
+		{
+		return (*chunks[index/chunkSize])[index%chunkSize];
+		}
+	Content& operator[](size_t index) // Ditto
+		{
+		return (*chunks[index/chunkSize])[index%chunkSize];
 		}
 	const Content& back(void) const // Returns reference to the last element in the array
 		{
@@ -270,6 +279,7 @@ class ChunkedArray
 			/* Create the first chunk: */
 			firstChunk=new Chunk;
 			lastChunk=firstChunk;
+			chunks.push_back(lastChunk);
 			}
 		
 		/* Check if there is room in the last chunk: */
@@ -278,18 +288,21 @@ class ChunkedArray
 			/* Create a new chunk: */
 			lastChunk->header.succ=new Chunk;
 			lastChunk=lastChunk->header.succ;
+			chunks.push_back(lastChunk);
 			}
 		
 		/* Append the new element to the last chunk: */
 		new(lastChunk->getAddress(lastChunk->header.numElements)) Content(newElement);
 		
-		/* Increase the element count of the last chunk: */
+		/* Increase the element counts of the last chunk and the array: */
 		++lastChunk->header.numElements;
+		++numElements;
 		}
 	void pop_back(void) // Removes the last element of the array
 		{
-		/* Decrease the element count of the last chunk: */
+		/* Decrease the element counts of the last chunk and the array: */
 		--lastChunk->header.numElements;
+		--numElements;
 		
 		/* Destroy the last element: */
 		(*lastChunk)[lastChunk->header.numElements].~Content();
@@ -297,18 +310,22 @@ class ChunkedArray
 		/* Remove last chunk if it is empty: */
 		if(lastChunk->header.numElements==0)
 			{
-			/* Find pointer to but-last chunk: */
-			Chunk* chPtr1=0;
-			for(Chunk* chPtr2=firstChunk;chPtr2!=lastChunk;chPtr1=chPtr2,chPtr2=chPtr2->header.succ)
-				;
-			
 			/* Remove last chunk: */
 			delete lastChunk;
-			lastChunk=chPtr1;
+			chunks.pop_back();
 			
 			/* Check for empty array: */
-			if(lastChunk==0)
+			if(chunks.empty())
+				{
 				firstChunk=0;
+				lastChunk=0;
+				}
+			else
+				{
+				/* Terminate the list at the but-last chunk: */
+				lastChunk=chunks.back();
+				lastChunk->header.succ=0;
+				}
 			}
 		}
 	void clear(void) // Clears all elements from the array
@@ -327,6 +344,8 @@ class ChunkedArray
 			firstChunk=succ;
 			}
 		lastChunk=0;
+		chunks.clear();
+		numElements=0;
 		}
 	const_iterator begin(void) const // Returns iterator to the first element
 		{
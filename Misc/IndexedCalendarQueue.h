@@ -0,0 +1,370 @@
+/***********************************************************************
+IndexedCalendarQueue - Implementation of a priority queue that sorts
+elements into buckets covering equal key ranges of a time window, where
+each element is associated with an integer handle, such that elements
+can be replaced or removed by handle in constant time.
+***********************************************************************/
+
+#ifndef MISC_INDEXEDCALENDARQUEUE_INCLUDED
+#define MISC_INDEXEDCALENDARQUEUE_INCLUDED
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+namespace Misc {
+
+template <class Content,class Key>
+class IndexedCalendarQueue // Key must provide static double getKey(const Content&)
+	{
+	/* Embedded classes: */
+	public:
+	static const size_t invalidHandle=~size_t(0); // Handle terminating bucket lists
+	static const size_t invalidBucket=~size_t(0); // Bucket of handles that are not currently in the queue
+	static const size_t minNumBuckets=16; // Smallest number of buckets covering a window
+
+	/* Elements: */
+	private:
+	size_t numHandles; // Number of valid handles
+	size_t handleAllocSize; // Size of allocated per-handle arrays
+	void* memChunk; // Pointer to uninitialized memory for the elements
+	Content* elements; // Element associated with each handle, only constructed while the handle is in the queue
+	size_t* buckets; // Bucket containing each handle, or invalidBucket
+	size_t* preds; // Predecessor of each handle in its bucket
+	size_t* succs; // Successor of each handle in its bucket
+	size_t numElements; // Number of elements currently in the queue
+	size_t numOverflowElements; // Number of elements in the overflow bucket
+	double windowBegin; // Smallest key covered by the first bucket
+	double bucketWidth; // Range of keys covered by each bucket
+	double invBucketWidth; // Inverse of bucket width
+	std::vector<size_t> bucketHeads; // First handle in each bucket; the last bucket holds all elements beyond the window
+	size_t numBuckets; // Number of buckets covering the window, not counting the overflow bucket
+	size_t currentBucket; // Index of the first bucket that may contain elements
+	mutable size_t smallestHandle; // Cached handle of the smallest element, or invalidHandle
+	std::vector<size_t> redistributeHandles; // Scratch list of handles collected while re-sorting the elements into buckets
+
+	/* Private methods: */
+	void reallocateHandles(size_t newHandleAllocSize)
+		{
+		/* Allocate new per-handle arrays: */
+		void* newMemChunk=new char[newHandleAllocSize*sizeof(Content)];
+		Content* newElements=static_cast<Content*>(newMemChunk);
+		size_t* newBuckets=new size_t[newHandleAllocSize];
+		size_t* newPreds=new size_t[newHandleAllocSize];
+		size_t* newSuccs=new size_t[newHandleAllocSize];
+
+		/* Copy all valid handles' state, then delete the old elements: */
+		for(size_t i=0;i<numHandles;++i)
+			{
+			newBuckets[i]=buckets[i];
+			newPreds[i]=preds[i];
+			newSuccs[i]=succs[i];
+			if(buckets[i]!=invalidBucket)
+				{
+				new(&newElements[i]) Content(elements[i]);
+				elements[i].~Content();
+				}
+			}
+
+		/* Delete the old arrays and use the new ones: */
+		delete[] static_cast<char*>(memChunk);
+		delete[] buckets;
+		delete[] preds;
+		delete[] succs;
+		handleAllocSize=newHandleAllocSize;
+		memChunk=newMemChunk;
+		elements=newElements;
+		buckets=newBuckets;
+		preds=newPreds;
+		succs=newSuccs;
+		}
+	size_t calcBucket(const Content& element) const // Returns the bucket into which an element has to be sorted
+		{
+		/* Elements before the current bucket go into the current bucket; elements beyond the window into the overflow bucket: */
+		double offset=(Key::getKey(element)-windowBegin)*invBucketWidth;
+		if(!(offset>=double(currentBucket)))
+			return currentBucket;
+		if(offset>=double(numBuckets))
+			return numBuckets;
+		return size_t(offset);
+		}
+	void link(size_t handle,size_t bucket) // Links the handle into the front of the given bucket
+		{
+		buckets[handle]=bucket;
+		if(bucket==numBuckets)
+			++numOverflowElements;
+		preds[handle]=invalidHandle;
+		succs[handle]=bucketHeads[bucket];
+		if(bucketHeads[bucket]!=invalidHandle)
+			preds[bucketHeads[bucket]]=handle;
+		bucketHeads[bucket]=handle;
+		}
+	void unlink(size_t handle) // Unlinks the handle from its bucket
+		{
+		if(preds[handle]!=invalidHandle)
+			succs[preds[handle]]=succs[handle];
+		else
+			bucketHeads[buckets[handle]]=succs[handle];
+		if(succs[handle]!=invalidHandle)
+			preds[succs[handle]]=preds[handle];
+		if(buckets[handle]==numBuckets)
+			--numOverflowElements;
+		}
+	void collectHandles(std::vector<size_t>& handles) const // Replaces the given list by the handles of all elements
+		{
+		handles.clear();
+		for(std::vector<size_t>::const_iterator bhIt=bucketHeads.begin();bhIt!=bucketHeads.end();++bhIt)
+			for(size_t handle=*bhIt;handle!=invalidHandle;handle=succs[handle])
+				handles.push_back(handle);
+		}
+	void redistribute(const std::vector<size_t>& handles,size_t newNumBuckets) // Sorts the given elements into the given number of buckets covering the current window
+		{
+		numBuckets=newNumBuckets;
+		bucketHeads.assign(numBuckets+1,invalidHandle);
+		numOverflowElements=0;
+		for(std::vector<size_t>::const_iterator hIt=handles.begin();hIt!=handles.end();++hIt)
+			link(*hIt,calcBucket(elements[*hIt]));
+		}
+	void findSmallest(void) const // Finds the smallest element and caches its handle
+		{
+		/* Skip all empty buckets: */
+		size_t bucket=currentBucket;
+		while(bucketHeads[bucket]==invalidHandle)
+			++bucket;
+		const_cast<IndexedCalendarQueue*>(this)->currentBucket=bucket;
+
+		/* Find the smallest element in the first non-empty bucket: */
+		smallestHandle=bucketHeads[bucket];
+		double smallestKey=Key::getKey(elements[smallestHandle]);
+		for(size_t handle=succs[smallestHandle];handle!=invalidHandle;handle=succs[handle])
+			{
+			double key=Key::getKey(elements[handle]);
+			if(smallestKey>key)
+				{
+				smallestHandle=handle;
+				smallestKey=key;
+				}
+			}
+		}
+
+	/* Constructors and destructors: */
+	public:
+	IndexedCalendarQueue(size_t sNumHandles =0) // Creates empty queue for the given number of handles and the window [0, 1)
+		:numHandles(sNumHandles),handleAllocSize(sNumHandles),
+		 memChunk(new char[handleAllocSize*sizeof(Content)]),
+		 elements(static_cast<Content*>(memChunk)),
+		 buckets(new size_t[handleAllocSize]),
+		 preds(new size_t[handleAllocSize]),
+		 succs(new size_t[handleAllocSize]),
+		 numElements(0),numOverflowElements(0),
+		 windowBegin(0.0),bucketWidth(1.0/double(minNumBuckets)),invBucketWidth(double(minNumBuckets)),
+		 bucketHeads(minNumBuckets+1,invalidHandle),numBuckets(minNumBuckets),
+		 currentBucket(0),smallestHandle(invalidHandle)
+		{
+		for(size_t i=0;i<numHandles;++i)
+			buckets[i]=invalidBucket;
+		}
+	private:
+	IndexedCalendarQueue(const IndexedCalendarQueue& source); // Prohibit copy constructor
+	IndexedCalendarQueue& operator=(const IndexedCalendarQueue& source); // Prohibit assignment operator
+	public:
+	~IndexedCalendarQueue(void)
+		{
+		/* Destroy all queued elements: */
+		for(size_t i=0;i<numHandles;++i)
+			if(buckets[i]!=invalidBucket)
+				elements[i].~Content();
+		delete[] static_cast<char*>(memChunk);
+		delete[] buckets;
+		delete[] preds;
+		delete[] succs;
+		}
+
+	/* Methods: */
+	size_t getNumHandles(void) const // Returns the number of valid handles
+		{
+		return numHandles;
+		}
+	void setNumHandles(size_t newNumHandles) // Changes the number of valid handles; removes elements associated with invalidated handles
+		{
+		/* Remove all elements whose handles become invalid: */
+		for(size_t i=newNumHandles;i<numHandles;++i)
+			if(buckets[i]!=invalidBucket)
+				remove(i);
+
+		/* Grow the per-handle arrays if necessary: */
+		if(newNumHandles>handleAllocSize)
+			{
+			size_t newHandleAllocSize=(handleAllocSize*3)/2+1;
+			reallocateHandles(newHandleAllocSize>=newNumHandles?newHandleAllocSize:newNumHandles);
+			}
+
+		/* Initialize all new handles: */
+		for(size_t i=numHandles;i<newNumHandles;++i)
+			buckets[i]=invalidBucket;
+		numHandles=newNumHandles;
+		}
+	void setWindow(double newWindowBegin,double newWindowEnd) // Spreads the buckets over the given key range and re-sorts all elements; elements beyond the window are kept in an unsorted overflow bucket
+		{
+		/* Use about one bucket per element inside the new window: */
+		collectHandles(redistributeHandles);
+		size_t numInWindow=0;
+		for(std::vector<size_t>::iterator hIt=redistributeHandles.begin();hIt!=redistributeHandles.end();++hIt)
+			if(Key::getKey(elements[*hIt])<newWindowEnd)
+				++numInWindow;
+		size_t newNumBuckets=numInWindow>minNumBuckets?numInWindow:minNumBuckets;
+
+		windowBegin=newWindowBegin;
+		bucketWidth=(newWindowEnd-newWindowBegin)/double(newNumBuckets);
+		invBucketWidth=bucketWidth>0.0?1.0/bucketWidth:0.0;
+		currentBucket=0;
+		redistribute(redistributeHandles,newNumBuckets);
+		smallestHandle=invalidHandle;
+		}
+	bool isEmpty(void) const
+		{
+		return numElements==0;
+		}
+	size_t getNumElements(void) const
+		{
+		return numElements;
+		}
+	void clear(void) // Removes all elements from the queue; keeps the allocated arrays and the current window
+		{
+		/* Destroy all queued elements and invalidate their handles: */
+		for(std::vector<size_t>::iterator bhIt=bucketHeads.begin();bhIt!=bucketHeads.end();++bhIt)
+			{
+			for(size_t handle=*bhIt;handle!=invalidHandle;handle=succs[handle])
+				{
+				elements[handle].~Content();
+				buckets[handle]=invalidBucket;
+				}
+			*bhIt=invalidHandle;
+			}
+		numElements=0;
+		numOverflowElements=0;
+		currentBucket=0;
+		smallestHandle=invalidHandle;
+		}
+	bool contains(size_t handle) const // Returns true if an element is associated with the given handle
+		{
+		return buckets[handle]!=invalidBucket;
+		}
+	const Content& get(size_t handle) const // Returns the element associated with the given handle
+		{
+		return elements[handle];
+		}
+	IndexedCalendarQueue& insert(size_t handle,const Content& newElement) // Inserts an element for a handle that is not currently associated with an element
+		{
+		new(&elements[handle]) Content(newElement);
+		link(handle,calcBucket(newElement));
+		++numElements;
+		smallestHandle=invalidHandle;
+
+		/* Use more, narrower buckets if the current ones are getting crowded: */
+		if(numElements-numOverflowElements>numBuckets*2)
+			{
+			collectHandles(redistributeHandles);
+			bucketWidth*=0.5;
+			invBucketWidth*=2.0;
+			currentBucket*=2;
+			redistribute(redistributeHandles,numBuckets*2);
+			}
+
+		return *this;
+		}
+	IndexedCalendarQueue& replace(size_t handle,const Content& newElement) // Replaces the element associated with the given handle, or inserts a new element if there is none
+		{
+		if(buckets[handle]==invalidBucket)
+			return insert(handle,newElement);
+
+		/* Replace the element and move it to its new bucket if necessary: */
+		elements[handle]=newElement;
+		size_t bucket=calcBucket(newElement);
+		if(bucket!=buckets[handle])
+			{
+			unlink(handle);
+			link(handle,bucket);
+			}
+		smallestHandle=invalidHandle;
+		return *this;
+		}
+	IndexedCalendarQueue& remove(size_t handle) // Removes the element associated with the given handle
+		{
+		unlink(handle);
+		buckets[handle]=invalidBucket;
+		elements[handle].~Content();
+		--numElements;
+		smallestHandle=invalidHandle;
+		return *this;
+		}
+	const Content& getSmallest(void) const
+		{
+		if(smallestHandle==invalidHandle)
+			findSmallest();
+		return elements[smallestHandle];
+		}
+	size_t getSmallestHandle(void) const // Returns the handle associated with the smallest element
+		{
+		if(smallestHandle==invalidHandle)
+			findSmallest();
+		return smallestHandle;
+		}
+	IndexedCalendarQueue& removeSmallest(void)
+		{
+		return remove(getSmallestHandle());
+		}
+	template <class FunctorParam>
+	void forEach(FunctorParam& functor) // Applies given functor to each element in unspecified order; if the functor changes the elements' keys, setWindow() must be called before the next query
+		{
+		for(std::vector<size_t>::iterator bhIt=bucketHeads.begin();bhIt!=bucketHeads.end();++bhIt)
+			for(size_t handle=*bhIt;handle!=invalidHandle;handle=succs[handle])
+				functor(elements[handle]);
+		smallestHandle=invalidHandle;
+		}
+	template <class FunctorParam>
+	void renumberHandles(FunctorParam& functor) // Associates each element with the handle returned by functor(oldHandle); functor must map valid handles one-to-one onto valid handles
+		{
+		/* Move all elements to their new handles in a new element array: */
+		void* newMemChunk=new char[handleAllocSize*sizeof(Content)];
+		Content* newElements=static_cast<Content*>(newMemChunk);
+		std::vector<size_t> newBuckets(numHandles,invalidBucket);
+		for(size_t i=0;i<numHandles;++i)
+			if(buckets[i]!=invalidBucket)
+				{
+				size_t newHandle=functor(i);
+				new(&newElements[newHandle]) Content(elements[i]);
+				elements[i].~Content();
+				newBuckets[newHandle]=buckets[i];
+				}
+		delete[] static_cast<char*>(memChunk);
+		memChunk=newMemChunk;
+		elements=newElements;
+
+		/* Re-link all elements into their buckets: */
+		bucketHeads.assign(numBuckets+1,invalidHandle);
+		numOverflowElements=0;
+		for(size_t i=0;i<numHandles;++i)
+			{
+			buckets[i]=invalidBucket;
+			if(newBuckets[i]!=invalidBucket)
+				link(i,newBuckets[i]);
+			}
+		smallestHandle=invalidHandle;
+		}
+	};
+
+/*************************************************
+Static elements of class IndexedCalendarQueue:
+*************************************************/
+
+template <class Content,class Key>
+const size_t IndexedCalendarQueue<Content,Key>::invalidHandle;
+template <class Content,class Key>
+const size_t IndexedCalendarQueue<Content,Key>::invalidBucket;
+template <class Content,class Key>
+const size_t IndexedCalendarQueue<Content,Key>::minNumBuckets;
+
+}
+
+#endif
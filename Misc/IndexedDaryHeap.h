@@ -0,0 +1,338 @@
+/***********************************************************************
+IndexedDaryHeap - Implementation of a priority queue with a d-ary heap
+structure where each element is associated with an integer handle, such
+that elements can be replaced or removed by handle in logarithmic time.
+The heap array is aligned such that the children of each node share as
+few cache lines as possible.
+Copyright (c) 2003-2011 Oliver Kreylos
+Modified from IndexedPriorityHeap to use a d-ary heap in a cache-aligned
+array.
+
+This file is part of the Miscellaneous Support Library (Misc).
+
+The Miscellaneous Support Library is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Miscellaneous Support Library is distributed in the hope that it
+will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Miscellaneous Support Library; if not, write to the Free
+Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#ifndef MISC_INDEXEDDARYHEAP_INCLUDED
+#define MISC_INDEXEDDARYHEAP_INCLUDED
+
+#include <stddef.h>
+#include <new>
+#include <Misc/PriorityHeap.h>
+
+namespace Misc {
+
+template <class Content,int arityParam =4,class Comparison =StdComp<Content> >
+class IndexedDaryHeap
+	{
+	/* Embedded classes: */
+	public:
+	static const int arity=arityParam; // Number of children of each heap node
+	static const size_t invalidPosition=~size_t(0); // Heap position of handles that are not currently in the heap
+	static const size_t cacheLineSize=64; // Alignment of the heap array in bytes
+
+	/* Elements: */
+	private:
+	size_t allocSize; // Size of allocated heap array
+	float growRate; // Rate the heap and handle arrays grow at when running out of space
+	char* memChunk; // Pointer to uninitialized memory
+	size_t numElements; // Number of elements currently in heap
+	Content* heap; // Pointer to heap array; the first element of each group of siblings starts a cache line
+	size_t* heapHandles; // Array of handles of the elements in the heap array
+	size_t handleAllocSize; // Size of allocated handle position array
+	size_t numHandles; // Number of valid handles
+	size_t* positions; // Heap array position of the element associated with each handle, or invalidPosition
+
+	/* Private methods: */
+	static Content* alignHeap(char* memChunk) // Returns the heap array inside the given memory chunk
+		{
+		/* Align the chunk to a cache line, and offset the heap such that the children of the root start at an aligned position: */
+		size_t misalignment=reinterpret_cast<size_t>(memChunk)%cacheLineSize;
+		char* aligned=memChunk+(misalignment!=0?cacheLineSize-misalignment:0);
+		return reinterpret_cast<Content*>(aligned)+(arity-1);
+		}
+	static char* allocateChunk(size_t allocSize) // Allocates memory for a heap array of the given size
+		{
+		return new char[(allocSize+arity-1)*sizeof(Content)+cacheLineSize];
+		}
+	void reallocate(size_t newAllocSize)
+		{
+		/* Allocate a new memory chunk: */
+		allocSize=newAllocSize;
+		char* newMemChunk=allocateChunk(allocSize);
+		Content* newHeap=alignHeap(newMemChunk);
+		size_t* newHeapHandles=new size_t[allocSize];
+
+		/* Copy all entries from the old heap, then delete the old entries: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			new(&newHeap[i]) Content(heap[i]);
+			heap[i].~Content();
+			newHeapHandles[i]=heapHandles[i];
+			}
+
+		/* Delete the old heap and use the new one: */
+		delete[] memChunk;
+		delete[] heapHandles;
+		memChunk=newMemChunk;
+		heap=newHeap;
+		heapHandles=newHeapHandles;
+		}
+	void reallocateHandles(size_t newHandleAllocSize)
+		{
+		/* Allocate a new position array and copy all valid handles' positions: */
+		handleAllocSize=newHandleAllocSize;
+		size_t* newPositions=new size_t[handleAllocSize];
+		for(size_t i=0;i<numHandles;++i)
+			newPositions[i]=positions[i];
+
+		/* Delete the old position array and use the new one: */
+		delete[] positions;
+		positions=newPositions;
+		}
+	void moveUp(size_t insertionPos) // Lets the element at the given heap position percolate up the heap
+		{
+		Content element=heap[insertionPos];
+		size_t handle=heapHandles[insertionPos];
+		while(insertionPos>0)
+			{
+			size_t parent=(insertionPos-1)/arity;
+			if(Comparison::lessEqual(heap[parent],element))
+				break;
+			heap[insertionPos]=heap[parent];
+			heapHandles[insertionPos]=heapHandles[parent];
+			positions[heapHandles[insertionPos]]=insertionPos;
+			insertionPos=parent;
+			}
+		heap[insertionPos]=element;
+		heapHandles[insertionPos]=handle;
+		positions[handle]=insertionPos;
+		}
+	void moveDown(size_t insertionPos) // Lets the element at the given heap position trickle down the heap
+		{
+		Content element=heap[insertionPos];
+		size_t handle=heapHandles[insertionPos];
+		while(true)
+			{
+			/* Find the smallest of the node's children: */
+			size_t firstChild=insertionPos*arity+1;
+			if(firstChild>=numElements)
+				break;
+			size_t endChild=firstChild+arity;
+			if(endChild>numElements)
+				endChild=numElements;
+			size_t child=firstChild;
+			for(size_t c=firstChild+1;c<endChild;++c)
+				if(!Comparison::lessEqual(heap[child],heap[c]))
+					child=c;
+
+			if(Comparison::lessEqual(element,heap[child]))
+				break;
+			heap[insertionPos]=heap[child];
+			heapHandles[insertionPos]=heapHandles[child];
+			positions[heapHandles[insertionPos]]=insertionPos;
+			insertionPos=child;
+			}
+		heap[insertionPos]=element;
+		heapHandles[insertionPos]=handle;
+		positions[handle]=insertionPos;
+		}
+
+	/* Constructors and destructors: */
+	public:
+	IndexedDaryHeap(size_t sNumHandles =0,size_t sAllocSize =0,float sGrowRate =1.5) // Creates empty heap for the given number of handles
+		:allocSize(sAllocSize),growRate(sGrowRate),
+		 memChunk(allocateChunk(allocSize)),
+		 numElements(0),heap(alignHeap(memChunk)),
+		 heapHandles(new size_t[allocSize]),
+		 handleAllocSize(sNumHandles),numHandles(sNumHandles),
+		 positions(new size_t[handleAllocSize])
+		{
+		for(size_t i=0;i<numHandles;++i)
+			positions[i]=invalidPosition;
+		}
+	private:
+	IndexedDaryHeap(const IndexedDaryHeap& source); // Prohibit copy constructor
+	IndexedDaryHeap& operator=(const IndexedDaryHeap& source); // Prohibit assignment operator
+	public:
+	~IndexedDaryHeap(void)
+		{
+		/* Destroy all heap entries: */
+		for(size_t i=0;i<numElements;++i)
+			heap[i].~Content();
+
+		delete[] memChunk;
+		delete[] heapHandles;
+		delete[] positions;
+		}
+
+	/* Methods: */
+	size_t getNumHandles(void) const // Returns the number of valid handles
+		{
+		return numHandles;
+		}
+	void setNumHandles(size_t newNumHandles) // Changes the number of valid handles; removes elements associated with invalidated handles
+		{
+		/* Remove all elements whose handles become invalid: */
+		for(size_t i=newNumHandles;i<numHandles;++i)
+			if(positions[i]!=invalidPosition)
+				remove(i);
+
+		/* Grow the position array if necessary: */
+		if(newNumHandles>handleAllocSize)
+			{
+			size_t newHandleAllocSize=size_t(float(handleAllocSize)*growRate)+1;
+			reallocateHandles(newHandleAllocSize>=newNumHandles?newHandleAllocSize:newNumHandles);
+			}
+
+		/* Initialize all new handles: */
+		for(size_t i=numHandles;i<newNumHandles;++i)
+			positions[i]=invalidPosition;
+		numHandles=newNumHandles;
+		}
+	void reserve(size_t newAllocSize) // Grows the heap array to hold at least the given number of elements without reallocating
+		{
+		if(newAllocSize>allocSize)
+			reallocate(newAllocSize);
+		}
+	bool isEmpty(void) const
+		{
+		return numElements==0;
+		}
+	size_t getNumElements(void) const
+		{
+		return numElements;
+		}
+	void clear(void) // Removes all elements from the heap; keeps the allocated arrays
+		{
+		/* Destroy all heap entries and invalidate their handles: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			heap[i].~Content();
+			positions[heapHandles[i]]=invalidPosition;
+			}
+		numElements=0;
+		}
+	bool contains(size_t handle) const // Returns true if an element is associated with the given handle
+		{
+		return positions[handle]!=invalidPosition;
+		}
+	const Content& get(size_t handle) const // Returns the element associated with the given handle
+		{
+		return heap[positions[handle]];
+		}
+	IndexedDaryHeap& insert(size_t handle,const Content& newElement) // Inserts an element for a handle that is not currently associated with an element
+		{
+		if(numElements==allocSize)
+			reallocate(size_t(float(allocSize)*growRate)+1);
+
+		/* Append the new element to the heap and let it percolate up: */
+		new(&heap[numElements]) Content(newElement);
+		heapHandles[numElements]=handle;
+		positions[handle]=numElements;
+		++numElements;
+		moveUp(numElements-1);
+
+		return *this;
+		}
+	IndexedDaryHeap& replace(size_t handle,const Content& newElement) // Replaces the element associated with the given handle, or inserts a new element if there is none
+		{
+		size_t pos=positions[handle];
+		if(pos==invalidPosition)
+			return insert(handle,newElement);
+
+		/* Replace the element and move it up or down depending on the change of its key: */
+		bool up=!Comparison::lessEqual(heap[pos],newElement);
+		heap[pos]=newElement;
+		if(up)
+			moveUp(pos);
+		else
+			moveDown(pos);
+
+		return *this;
+		}
+	IndexedDaryHeap& remove(size_t handle) // Removes the element associated with the given handle
+		{
+		/* Get the element's heap position and invalidate the handle: */
+		size_t pos=positions[handle];
+		positions[handle]=invalidPosition;
+
+		/* Decrement the number of elements in the heap: */
+		--numElements;
+
+		if(pos<numElements)
+			{
+			/* Move the bottom item into the vacated position: */
+			heap[pos]=heap[numElements];
+			heapHandles[pos]=heapHandles[numElements];
+			positions[heapHandles[pos]]=pos;
+
+			/* Let the moved item percolate up or trickle down to its final position: */
+			if(pos>0&&!Comparison::lessEqual(heap[(pos-1)/arity],heap[pos]))
+				moveUp(pos);
+			else
+				moveDown(pos);
+			}
+
+		/* Destroy the element past the end of the heap: */
+		heap[numElements].~Content();
+
+		return *this;
+		}
+	const Content& getSmallest(void) const
+		{
+		return heap[0];
+		}
+	size_t getSmallestHandle(void) const // Returns the handle associated with the smallest element
+		{
+		return heapHandles[0];
+		}
+	IndexedDaryHeap& removeSmallest(void)
+		{
+		return remove(heapHandles[0]);
+		}
+	IndexedDaryHeap& reinsertSmallest(const Content& newElement) // Replaces the smallest element by the given element, keeping its handle
+		{
+		heap[0]=newElement;
+		moveDown(0);
+
+		return *this;
+		}
+	template <class FunctorParam>
+	void renumberHandles(FunctorParam& functor) // Associates each element with the handle returned by functor(oldHandle); functor must map valid handles one-to-one onto valid handles
+		{
+		/* Invalidate all handles' positions: */
+		for(size_t i=0;i<numHandles;++i)
+			positions[i]=invalidPosition;
+
+		/* Assign the new handles to the heap entries: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			heapHandles[i]=functor(heapHandles[i]);
+			positions[heapHandles[i]]=i;
+			}
+		}
+	template <class FunctorParam>
+	void forEach(FunctorParam& functor) // Applies given functor to each element in heap order; functor must not change the elements' relative order
+		{
+		for(size_t i=0;i<numElements;++i)
+			functor(heap[i]);
+		}
+	};
+
+}
+
+#endif
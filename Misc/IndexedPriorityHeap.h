@@ -0,0 +1,308 @@
+/***********************************************************************
+IndexedPriorityHeap - Implementation of a priority queue with a heap
+structure where each element is associated with an integer handle, such
+that elements can be replaced or removed by handle in logarithmic time.
+Copyright (c) 2003-2011 Oliver Kreylos
+Modified from PriorityHeap to associate elements with integer handles.
+
+This file is part of the Miscellaneous Support Library (Misc).
+
+The Miscellaneous Support Library is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Miscellaneous Support Library is distributed in the hope that it
+will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Miscellaneous Support Library; if not, write to the Free
+Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#ifndef MISC_INDEXEDPRIORITYHEAP_INCLUDED
+#define MISC_INDEXEDPRIORITYHEAP_INCLUDED
+
+#include <stddef.h>
+#include <new>
+#include <Misc/PriorityHeap.h>
+
+namespace Misc {
+
+template <class Content,class Comparison =StdComp<Content> >
+class IndexedPriorityHeap
+	{
+	/* Embedded classes: */
+	public:
+	static const size_t invalidPosition=~size_t(0); // Heap position of handles that are not currently in the heap
+
+	/* Elements: */
+	private:
+	size_t allocSize; // Size of allocated heap array
+	float growRate; // Rate the heap and handle arrays grow at when running out of space
+	void* memChunk; // Pointer to uninitialized memory
+	size_t numElements; // Number of elements currently in heap
+	Content* heap; // Pointer to heap array
+	size_t* heapHandles; // Array of handles of the elements in the heap array
+	size_t handleAllocSize; // Size of allocated handle position array
+	size_t numHandles; // Number of valid handles
+	size_t* positions; // Heap array position of the element associated with each handle, or invalidPosition
+
+	/* Private methods: */
+	void reallocate(size_t newAllocSize)
+		{
+		/* Allocate a new memory chunk: */
+		allocSize=newAllocSize;
+		void* newMemChunk=new char[allocSize*sizeof(Content)];
+		Content* newHeap=static_cast<Content*>(newMemChunk);
+		size_t* newHeapHandles=new size_t[allocSize];
+
+		/* Copy all entries from the old heap, then delete the old entries: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			new(&newHeap[i]) Content(heap[i]);
+			heap[i].~Content();
+			newHeapHandles[i]=heapHandles[i];
+			}
+
+		/* Delete the old heap and use the new one: */
+		delete[] static_cast<char*>(memChunk);
+		delete[] heapHandles;
+		memChunk=newMemChunk;
+		heap=newHeap;
+		heapHandles=newHeapHandles;
+		}
+	void reallocateHandles(size_t newHandleAllocSize)
+		{
+		/* Allocate a new position array and copy all valid handles' positions: */
+		handleAllocSize=newHandleAllocSize;
+		size_t* newPositions=new size_t[handleAllocSize];
+		for(size_t i=0;i<numHandles;++i)
+			newPositions[i]=positions[i];
+
+		/* Delete the old position array and use the new one: */
+		delete[] positions;
+		positions=newPositions;
+		}
+	void moveUp(size_t insertionPos) // Lets the element at the given heap position percolate up the heap
+		{
+		Content element=heap[insertionPos];
+		size_t handle=heapHandles[insertionPos];
+		while(insertionPos>0)
+			{
+			size_t parent=(insertionPos-1)>>1;
+			if(Comparison::lessEqual(heap[parent],element))
+				break;
+			heap[insertionPos]=heap[parent];
+			heapHandles[insertionPos]=heapHandles[parent];
+			positions[heapHandles[insertionPos]]=insertionPos;
+			insertionPos=parent;
+			}
+		heap[insertionPos]=element;
+		heapHandles[insertionPos]=handle;
+		positions[handle]=insertionPos;
+		}
+	void moveDown(size_t insertionPos) // Lets the element at the given heap position trickle down the heap
+		{
+		Content element=heap[insertionPos];
+		size_t handle=heapHandles[insertionPos];
+		while(true)
+			{
+			size_t child=(insertionPos<<1)+1;
+			if(child>=numElements)
+				break;
+			if(child+1<numElements&&!Comparison::lessEqual(heap[child],heap[child+1]))
+				++child;
+			if(Comparison::lessEqual(element,heap[child]))
+				break;
+			heap[insertionPos]=heap[child];
+			heapHandles[insertionPos]=heapHandles[child];
+			positions[heapHandles[insertionPos]]=insertionPos;
+			insertionPos=child;
+			}
+		heap[insertionPos]=element;
+		heapHandles[insertionPos]=handle;
+		positions[handle]=insertionPos;
+		}
+
+	/* Constructors and destructors: */
+	public:
+	IndexedPriorityHeap(size_t sNumHandles =0,size_t sAllocSize =0,float sGrowRate =1.5) // Creates empty heap for the given number of handles
+		:allocSize(sAllocSize),growRate(sGrowRate),
+		 memChunk(new char[allocSize*sizeof(Content)]),
+		 numElements(0),heap(static_cast<Content*>(memChunk)),
+		 heapHandles(new size_t[allocSize]),
+		 handleAllocSize(sNumHandles),numHandles(sNumHandles),
+		 positions(handleAllocSize!=0?new size_t[handleAllocSize]:0)
+		{
+		for(size_t i=0;i<numHandles;++i)
+			positions[i]=invalidPosition;
+		}
+	private:
+	IndexedPriorityHeap(const IndexedPriorityHeap& source); // Prohibit copy constructor
+	IndexedPriorityHeap& operator=(const IndexedPriorityHeap& source); // Prohibit assignment operator
+	public:
+	~IndexedPriorityHeap(void)
+		{
+		/* Destroy all heap entries: */
+		for(size_t i=0;i<numElements;++i)
+			heap[i].~Content();
+
+		delete[] static_cast<char*>(memChunk);
+		delete[] heapHandles;
+		delete[] positions;
+		}
+
+	/* Methods: */
+	size_t getNumHandles(void) const // Returns the number of valid handles
+		{
+		return numHandles;
+		}
+	void setNumHandles(size_t newNumHandles) // Changes the number of valid handles; removes elements associated with invalidated handles
+		{
+		/* Remove all elements whose handles become invalid: */
+		for(size_t i=newNumHandles;i<numHandles;++i)
+			if(positions[i]!=invalidPosition)
+				remove(i);
+
+		/* Grow the position array if necessary: */
+		if(newNumHandles>handleAllocSize)
+			{
+			size_t newHandleAllocSize=size_t(float(handleAllocSize)*growRate)+1;
+			reallocateHandles(newHandleAllocSize>=newNumHandles?newHandleAllocSize:newNumHandles);
+			}
+
+		/* Initialize all new handles: */
+		for(size_t i=numHandles;i<newNumHandles;++i)
+			positions[i]=invalidPosition;
+		numHandles=newNumHandles;
+		}
+	void reserve(size_t newAllocSize) // Grows the heap array to hold at least the given number of elements without reallocating
+		{
+		if(newAllocSize>allocSize)
+			reallocate(newAllocSize);
+		}
+	bool isEmpty(void) const
+		{
+		return numElements==0;
+		}
+	size_t getNumElements(void) const
+		{
+		return numElements;
+		}
+	void clear(void) // Removes all elements from the heap; keeps the allocated arrays
+		{
+		/* Destroy all heap entries and invalidate their handles: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			heap[i].~Content();
+			positions[heapHandles[i]]=invalidPosition;
+			}
+		numElements=0;
+		}
+	bool contains(size_t handle) const // Returns true if an element is associated with the given handle
+		{
+		return positions[handle]!=invalidPosition;
+		}
+	const Content& get(size_t handle) const // Returns the element associated with the given handle
+		{
+		return heap[positions[handle]];
+		}
+	IndexedPriorityHeap& insert(size_t handle,const Content& newElement) // Inserts an element for a handle that is not currently associated with an element
+		{
+		if(numElements==allocSize)
+			reallocate(size_t(float(allocSize)*growRate)+1);
+
+		/* Append the new element to the heap and let it percolate up: */
+		new(&heap[numElements]) Content(newElement);
+		heapHandles[numElements]=handle;
+		positions[handle]=numElements;
+		++numElements;
+		moveUp(numElements-1);
+
+		return *this;
+		}
+	IndexedPriorityHeap& replace(size_t handle,const Content& newElement) // Replaces the element associated with the given handle, or inserts a new element if there is none
+		{
+		size_t pos=positions[handle];
+		if(pos==invalidPosition)
+			return insert(handle,newElement);
+
+		/* Replace the element and move it up or down depending on the change of its key: */
+		bool up=!Comparison::lessEqual(heap[pos],newElement);
+		heap[pos]=newElement;
+		if(up)
+			moveUp(pos);
+		else
+			moveDown(pos);
+
+		return *this;
+		}
+	IndexedPriorityHeap& remove(size_t handle) // Removes the element associated with the given handle
+		{
+		/* Get the element's heap position and invalidate the handle: */
+		size_t pos=positions[handle];
+		positions[handle]=invalidPosition;
+
+		/* Decrement the number of elements in the heap: */
+		--numElements;
+
+		if(pos<numElements)
+			{
+			/* Move the bottom item into the vacated position: */
+			heap[pos]=heap[numElements];
+			heapHandles[pos]=heapHandles[numElements];
+			positions[heapHandles[pos]]=pos;
+
+			/* Let the moved item percolate up or trickle down to its final position: */
+			if(pos>0&&!Comparison::lessEqual(heap[(pos-1)>>1],heap[pos]))
+				moveUp(pos);
+			else
+				moveDown(pos);
+			}
+
+		/* Destroy the element past the end of the heap: */
+		heap[numElements].~Content();
+
+		return *this;
+		}
+	const Content& getSmallest(void) const
+		{
+		return heap[0];
+		}
+	size_t getSmallestHandle(void) const // Returns the handle associated with the smallest element
+		{
+		return heapHandles[0];
+		}
+	IndexedPriorityHeap& removeSmallest(void)
+		{
+		return remove(heapHandles[0]);
+		}
+	template <class FunctorParam>
+	void renumberHandles(FunctorParam& functor) // Associates each element with the handle returned by functor(oldHandle); functor must map valid handles one-to-one onto valid handles
+		{
+		/* Invalidate all handles' positions: */
+		for(size_t i=0;i<numHandles;++i)
+			positions[i]=invalidPosition;
+		
+		/* Assign the new handles to the heap entries: */
+		for(size_t i=0;i<numElements;++i)
+			{
+			heapHandles[i]=functor(heapHandles[i]);
+			positions[heapHandles[i]]=i;
+			}
+		}
+	template <class FunctorParam>
+	void forEach(FunctorParam& functor) // Applies given functor to each element in heap order; functor must not change the elements' relative order
+		{
+		for(size_t i=0;i<numElements;++i)
+			functor(heap[i]);
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+/***********************************************************************
+RegionTimers - Class to accumulate the time spent in named regions of
+code over frames, measured by scoped timers that add the time from their
+construction to their destruction to a region.
+***********************************************************************/
+
+#ifndef MISC_REGIONTIMERS_INCLUDED
+#define MISC_REGIONTIMERS_INCLUDED
+
+#include <string>
+#include <vector>
+#include <Misc/Timer.h>
+
+namespace Misc {
+
+class RegionTimers
+	{
+	/* Embedded classes: */
+	public:
+	class Scope // Class to add the time between its construction and destruction to a region
+		{
+		/* Elements: */
+		private:
+		RegionTimers& regionTimers; // Timers receiving the measured time
+		int region; // Index of the measured region
+		Timer timer; // Timer started at construction
+
+		/* Constructors and destructors: */
+		public:
+		Scope(RegionTimers& sRegionTimers,int sRegion) // Starts measuring the given region
+			:regionTimers(sRegionTimers),region(sRegion)
+			{
+			}
+		private:
+		Scope(const Scope& source); // Prohibit copy constructor
+		Scope& operator=(const Scope& source); // Prohibit assignment operator
+		public:
+		~Scope(void) // Adds the time since construction to the region
+			{
+			regionTimers.addTime(region,timer.peekTime());
+			}
+		};
+
+	private:
+	struct Region // Structure for the accumulated times of a region
+		{
+		/* Elements: */
+		public:
+		std::string name; // Name of the region
+		double frameTime; // Time spent in the region during the current frame
+		double lastFrameTime; // Time spent in the region during the last finished frame
+		double totalTime; // Time spent in the region during all finished frames
+
+		/* Constructors and destructors: */
+		Region(const char* sName)
+			:name(sName),frameTime(0.0),lastFrameTime(0.0),totalTime(0.0)
+			{
+			}
+		};
+
+	/* Elements: */
+	std::vector<Region> regions; // List of regions in the order they were added
+	unsigned int numFrames; // Number of finished frames
+
+	/* Constructors and destructors: */
+	public:
+	RegionTimers(void) // Creates timers without regions
+		:numFrames(0)
+		{
+		}
+
+	/* Methods: */
+	int addRegion(const char* name) // Adds a region of the given name and returns its index
+		{
+		regions.push_back(Region(name));
+		return int(regions.size())-1;
+		}
+	int getNumRegions(void) const
+		{
+		return int(regions.size());
+		}
+	const std::string& getRegionName(int region) const
+		{
+		return regions[region].name;
+		}
+	void addTime(int region,double seconds) // Adds the given time to the region's current frame
+		{
+		regions[region].frameTime+=seconds;
+		}
+	void finishFrame(void) // Finishes the current frame and starts a new one
+		{
+		for(std::vector<Region>::iterator rIt=regions.begin();rIt!=regions.end();++rIt)
+			{
+			rIt->lastFrameTime=rIt->frameTime;
+			rIt->totalTime+=rIt->frameTime;
+			rIt->frameTime=0.0;
+			}
+		++numFrames;
+		}
+	void reset(void) // Resets all regions' times and the frame count
+		{
+		for(std::vector<Region>::iterator rIt=regions.begin();rIt!=regions.end();++rIt)
+			rIt->frameTime=rIt->lastFrameTime=rIt->totalTime=0.0;
+		numFrames=0;
+		}
+	unsigned int getNumFrames(void) const // Returns the number of finished frames
+		{
+		return numFrames;
+		}
+	double getLastFrameTime(int region) const // Returns the time spent in the region during the last finished frame
+		{
+		return regions[region].lastFrameTime;
+		}
+	double getTotalTime(int region) const // Returns the time spent in the region during all finished frames
+		{
+		return regions[region].totalTime;
+		}
+	};
+
+}
+
+#endif
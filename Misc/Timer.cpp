@@ -98,46 +98,33 @@ double Timer::peekTime(void) const
 #else
 
 Timer::Timer(void)
-	:elapsedSeconds(0),elapsedMicrons(0)
+	:elapsedSeconds(0),elapsedNanos(0)
 	{
-	gettimeofday(&lastMeasured,0);
+	clock_gettime(CLOCK_MONOTONIC,&lastMeasured);
 	}
 
 void Timer::elapse(void)
 	{
-	struct timeval newMeasured;
-	gettimeofday(&newMeasured,0);
+	struct timespec newMeasured;
+	clock_gettime(CLOCK_MONOTONIC,&newMeasured);
 	
-	elapsedMicrons=newMeasured.tv_usec-lastMeasured.tv_usec;
-	int secondCarry=0;
-	if(elapsedMicrons<0) // Correct for end-of-second wraparound
+	/* The monotonic clock never runs backwards, so only the end-of-second wraparound needs correcting: */
+	elapsedSeconds=long(newMeasured.tv_sec-lastMeasured.tv_sec);
+	elapsedNanos=newMeasured.tv_nsec-lastMeasured.tv_nsec;
+	if(elapsedNanos<0)
 		{
-		elapsedMicrons+=1000000;
-		secondCarry=1;
+		elapsedNanos+=1000000000L;
+		--elapsedSeconds;
 		}
-	elapsedSeconds=(newMeasured.tv_sec-secondCarry)-lastMeasured.tv_sec;
-	if(elapsedSeconds<0) // Correct for end-of-day wraparound
-		elapsedSeconds+=86400;
 	lastMeasured=newMeasured;
 	}
 
 double Timer::peekTime(void) const
 	{
-	struct timeval newMeasured;
-	gettimeofday(&newMeasured,0);
+	struct timespec newMeasured;
+	clock_gettime(CLOCK_MONOTONIC,&newMeasured);
 	
-	int passedMicrons=newMeasured.tv_usec-lastMeasured.tv_usec;
-	int secondCarry=0;
-	if(passedMicrons<0) // Correct for end-of-second wraparound
-		{
-		passedMicrons+=1000000;
-		secondCarry=1;
-		}
-	int passedSeconds=(newMeasured.tv_sec-secondCarry)-lastMeasured.tv_sec;
-	if(passedSeconds<0) // Correct for end-of-day wraparound
-		passedSeconds+=86400;
-	
-	return double(passedSeconds)+double(passedMicrons)/1000000.0;
+	return double(newMeasured.tv_sec-lastMeasured.tv_sec)+double(newMeasured.tv_nsec-lastMeasured.tv_nsec)/1000000000.0;
 	}
 
 #endif
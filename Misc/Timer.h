@@ -29,7 +29,7 @@ Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <math.h>
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <time.h>
 #endif
 
 namespace Misc {
@@ -43,8 +43,8 @@ class Timer
 	LARGE_INTEGER lastMeasured; // Performance counter value at last measuring point
 	double elapsedSeconds; // Number of seconds in the last timing period
 	#else
-	struct timeval lastMeasured; // Time value at last measuring point
-	int elapsedSeconds,elapsedMicrons; // Number of seconds and microseconds in the last timing period
+	struct timespec lastMeasured; // Monotonic clock value at last measuring point
+	long elapsedSeconds,elapsedNanos; // Number of seconds and nanoseconds in the last timing period
 	#endif
 	
 	/* Constructors and destructors: */
@@ -58,7 +58,7 @@ class Timer
 		#ifdef WIN32
 		return int(floor(elapsedSeconds));
 		#else
-		return elapsedSeconds;
+		return int(elapsedSeconds);
 		#endif
 		}
 	int getMicrons(void) const // Returns the number of fractional microseconds in the last timing period
@@ -66,7 +66,7 @@ class Timer
 		#ifdef WIN32
 		return int(floor((elapsedSeconds-floor(elapsedSeconds))*1000000.0));
 		#else
-		return elapsedMicrons;
+		return int(elapsedNanos/1000);
 		#endif
 		}
 	double getTime(void) const // Returns the amount of measured time, in seconds
@@ -74,7 +74,7 @@ class Timer
 		#if WIN32
 		return elapsedSeconds;
 		#else
-		return double(elapsedSeconds)+double(elapsedMicrons)/1000000.0;
+		return double(elapsedSeconds)+double(elapsedNanos)/1000000000.0;
 		#endif
 		}
 	double peekTime(void) const; // Returns the amount of time passed since the last time elapse() was called
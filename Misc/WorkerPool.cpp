@@ -0,0 +1,105 @@
+/***********************************************************************
+WorkerPool - Class for a fixed set of worker threads that wait for
+batches of tasks and run them together with the calling thread, so that
+short parallel phases do not pay for creating and joining threads.
+***********************************************************************/
+
+#include <Misc/WorkerPool.h>
+
+namespace Misc {
+
+/***************************
+Methods of class WorkerPool:
+***************************/
+
+void WorkerPool::workerLoop(int workerIndex,unsigned int startBatch)
+	{
+	unsigned int lastBatch=startBatch;
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true)
+		{
+		/* Wait for the next batch: */
+		while(!exitWorkers&&batchCounter==lastBatch)
+			batchCond.wait(lock);
+		if(exitWorkers)
+			break;
+		lastBatch=batchCounter;
+
+		/* Run the worker's task if the batch has one for it: */
+		int taskIndex=workerIndex+1;
+		if(taskIndex<numTasks)
+			{
+			const Task& batchTask=*task;
+			lock.unlock();
+			batchTask(taskIndex);
+			lock.lock();
+			if(--numBusyWorkers==0)
+				doneCond.notify_one();
+			}
+		}
+	}
+
+void WorkerPool::stopWorkers(void)
+	{
+	{
+	std::lock_guard<std::mutex> lock(mutex);
+	exitWorkers=true;
+	}
+	batchCond.notify_all();
+	for(std::vector<std::thread>::iterator wIt=workers.begin();wIt!=workers.end();++wIt)
+		wIt->join();
+	workers.clear();
+	exitWorkers=false;
+	}
+
+WorkerPool::WorkerPool(void)
+	:task(0),numTasks(0),batchCounter(0),numBusyWorkers(0),exitWorkers(false)
+	{
+	}
+
+WorkerPool::~WorkerPool(void)
+	{
+	stopWorkers();
+	}
+
+void WorkerPool::setNumWorkers(int newNumWorkers)
+	{
+	stopWorkers();
+	workers.reserve(newNumWorkers>0?newNumWorkers:0);
+	for(int i=0;i<newNumWorkers;++i)
+		workers.push_back(std::thread(&WorkerPool::workerLoop,this,i,batchCounter));
+	}
+
+void WorkerPool::run(int newNumTasks,const Task& newTask)
+	{
+	/* Hand out one task to each worker that has one in this batch: */
+	int numWorkerTasks=newNumTasks-1;
+	if(numWorkerTasks>int(workers.size()))
+		numWorkerTasks=int(workers.size());
+	if(numWorkerTasks>0)
+		{
+		{
+		std::lock_guard<std::mutex> lock(mutex);
+		task=&newTask;
+		numTasks=newNumTasks;
+		numBusyWorkers=numWorkerTasks;
+		++batchCounter;
+		}
+		batchCond.notify_all();
+		}
+
+	/* Run the first task and all tasks without a worker in the calling thread: */
+	newTask(0);
+	for(int taskIndex=numWorkerTasks+1;taskIndex<newNumTasks;++taskIndex)
+		newTask(taskIndex);
+
+	/* Wait for the workers to finish: */
+	if(numWorkerTasks>0)
+		{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(numBusyWorkers>0)
+			doneCond.wait(lock);
+		}
+	}
+
+}
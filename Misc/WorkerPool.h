@@ -0,0 +1,60 @@
+/***********************************************************************
+WorkerPool - Class for a fixed set of worker threads that wait for
+batches of tasks and run them together with the calling thread, so that
+short parallel phases do not pay for creating and joining threads.
+***********************************************************************/
+
+#ifndef MISC_WORKERPOOL_INCLUDED
+#define MISC_WORKERPOOL_INCLUDED
+
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Misc {
+
+class WorkerPool
+	{
+	/* Embedded classes: */
+	public:
+	typedef std::function<void (int)> Task; // Function called with the index of each task of a batch
+
+	/* Elements: */
+	private:
+	std::vector<std::thread> workers; // Worker threads; worker i runs task i+1 of each batch
+	std::mutex mutex; // Mutex protecting the batch state
+	std::condition_variable batchCond; // Condition signalled when a batch starts or the workers have to exit
+	std::condition_variable doneCond; // Condition signalled when the last worker finishes its task of a batch
+	const Task* task; // Task function of the current batch
+	int numTasks; // Number of tasks in the current batch
+	unsigned int batchCounter; // Number of started batches; idle workers wait for it to change
+	int numBusyWorkers; // Number of workers still running tasks of the current batch
+	bool exitWorkers; // Flag telling the worker threads to exit
+
+	/* Private methods: */
+	void workerLoop(int workerIndex,unsigned int startBatch); // Runs the worker's task of every batch started after the given one
+	void stopWorkers(void); // Lets all worker threads exit and joins them
+
+	/* Constructors and destructors: */
+	public:
+	WorkerPool(void); // Creates a pool without worker threads
+	private:
+	WorkerPool(const WorkerPool& source); // Prohibit copy constructor
+	WorkerPool& operator=(const WorkerPool& source); // Prohibit assignment operator
+	public:
+	~WorkerPool(void); // Stops all worker threads
+
+	/* Methods: */
+	int getNumWorkers(void) const // Returns the number of worker threads
+		{
+		return int(workers.size());
+		}
+	void setNumWorkers(int newNumWorkers); // Stops all worker threads and starts the given number of new ones; must not be called while a batch is running
+	void run(int newNumTasks,const Task& newTask); // Calls newTask(0) to newTask(newNumTasks-1) concurrently, with task 0 and all tasks without a worker in the calling thread, and returns when all tasks are finished
+	};
+
+}
+
+#endif
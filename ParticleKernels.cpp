@@ -0,0 +1,142 @@
+/***********************************************************************
+ParticleKernels - Fused kernels advancing the positions and velocities
+of many particles to the end of a simulation step. The float and double
+kernels for two and three dimensions are vectorized, and the instruction
+set they use is selected at run time based on the CPU's features.
+***********************************************************************/
+
+#include "ParticleKernels.h"
+
+/***********************************************************************
+On x86 with GCC or a recent clang, each vectorized kernel is compiled
+once per instruction set listed below, and the dynamic linker picks the
+best variant the CPU supports when the program starts. Elsewhere the
+kernels are compiled for the build's default target only.
+***********************************************************************/
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (!defined(__clang__) || __clang_major__>=14)
+#define PARTICLEKERNELS_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","avx","default")))
+#else
+#define PARTICLEKERNELS_TARGET_CLONES
+#endif
+
+/* Do not fuse multiplications and additions, so that all variants round exactly like the scalar code: */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+namespace ParticleKernels {
+
+namespace {
+
+template <class ScalarParam, int dimensionParam>
+inline
+void
+advanceKernel(
+    size_t numParticles,
+    ScalarParam* __restrict__ positions,
+    ScalarParam* __restrict__ velocities,
+    ScalarParam* __restrict__ timeStamps,
+    ScalarParam timeStep,
+    ScalarParam attenuation,
+    const ScalarParam* latentForce,
+    ScalarParam friction)
+{
+    /* Copy the latent force so the compiler can keep it in registers: */
+    ScalarParam force[dimensionParam];
+    for (int j=0;j<dimensionParam;++j)
+        force[j]=latentForce[j];
+
+    for (size_t i=0;i<numParticles;++i)
+    {
+        ScalarParam moveTime=timeStep-timeStamps[i];
+        timeStamps[i]=ScalarParam(0);
+        for (int j=0;j<dimensionParam;++j)
+        {
+            ScalarParam v=velocities[i*dimensionParam+j];
+            positions[i*dimensionParam+j]+=v*moveTime;
+            v=v*attenuation+force[j];
+            v-=v*friction;
+            velocities[i*dimensionParam+j]=v;
+        }
+    }
+}
+
+}
+
+PARTICLEKERNELS_TARGET_CLONES
+void advanceFloat2(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction)
+{
+    advanceKernel<float, 2>(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+PARTICLEKERNELS_TARGET_CLONES
+void advanceFloat3(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction)
+{
+    advanceKernel<float, 3>(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+PARTICLEKERNELS_TARGET_CLONES
+void advanceDouble2(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction)
+{
+    advanceKernel<double, 2>(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+PARTICLEKERNELS_TARGET_CLONES
+void advanceDouble3(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction)
+{
+    advanceKernel<double, 3>(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+/*********************************
+Functions of namespace ParticleKernels:
+*********************************/
+
+const char* getInstructionSet(void)
+{
+    #if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (!defined(__clang__) || __clang_major__>=14)
+    /* Check the CPU's features in the same order as the dynamic linker: */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512f";
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    if (__builtin_cpu_supports("avx"))
+        return "avx";
+    #if defined(__x86_64__)
+    return "sse2";
+    #else
+    return "default";
+    #endif
+    #else
+    return "default";
+    #endif
+}
+
+template <>
+void advance<float, 2>(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction)
+{
+    advanceFloat2(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+template <>
+void advance<float, 3>(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction)
+{
+    advanceFloat3(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+template <>
+void advance<double, 2>(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction)
+{
+    advanceDouble2(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+template <>
+void advance<double, 3>(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction)
+{
+    advanceDouble3(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+}
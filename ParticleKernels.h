@@ -0,0 +1,85 @@
+/***********************************************************************
+ParticleKernels - Fused kernels advancing the positions and velocities
+of many particles to the end of a simulation step. The float and double
+kernels for two and three dimensions are vectorized, and the instruction
+set they use is selected at run time based on the CPU's features.
+***********************************************************************/
+
+#ifndef PARTICLEKERNELS_INCLUDED
+#define PARTICLEKERNELS_INCLUDED
+
+#include <stddef.h>
+
+namespace ParticleKernels {
+
+const char* getInstructionSet(void); // Returns the name of the instruction set used by the vectorized kernels on this CPU
+
+/***********************************************************************
+Scalar reference implementation of advance(); the vectorized
+specializations round exactly like it.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+void
+advanceScalar(
+    size_t numParticles,
+    ScalarParam* positions,
+    ScalarParam* velocities,
+    ScalarParam* timeStamps,
+    ScalarParam timeStep,
+    ScalarParam attenuation,
+    const ScalarParam* latentForce,
+    ScalarParam friction)
+{
+    for (size_t i=0;i<numParticles;++i)
+    {
+        ScalarParam moveTime=timeStep-timeStamps[i];
+        timeStamps[i]=ScalarParam(0);
+        for (int j=0;j<dimensionParam;++j)
+        {
+            ScalarParam v=velocities[i*dimensionParam+j];
+            positions[i*dimensionParam+j]+=v*moveTime;
+            v=v*attenuation+latentForce[j];
+            v-=v*friction;
+            velocities[i*dimensionParam+j]=v;
+        }
+    }
+}
+
+/***********************************************************************
+Moves each particle along its velocity from its time stamp to the end of
+the time step and resets its time stamp; then attenuates its velocity,
+adds the latent force, and applies friction. Positions and velocities
+are arrays of numParticles*dimensionParam interleaved components.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+void
+advance(
+    size_t numParticles,
+    ScalarParam* positions,
+    ScalarParam* velocities,
+    ScalarParam* timeStamps,
+    ScalarParam timeStep,
+    ScalarParam attenuation,
+    const ScalarParam* latentForce,
+    ScalarParam friction)
+{
+    advanceScalar<ScalarParam, dimensionParam>(numParticles, positions, velocities, timeStamps, timeStep, attenuation, latentForce, friction);
+}
+
+/* Vectorized specializations: */
+template <>
+void advance<float, 2>(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction);
+template <>
+void advance<float, 3>(size_t numParticles, float* positions, float* velocities, float* timeStamps, float timeStep, float attenuation, const float* latentForce, float friction);
+template <>
+void advance<double, 2>(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction);
+template <>
+void advance<double, 3>(size_t numParticles, double* positions, double* velocities, double* timeStamps, double timeStep, double attenuation, const double* latentForce, double friction);
+
+}
+
+#endif
@@ -0,0 +1,362 @@
+/***********************************************************************
+ParticleSeeding - Functions to generate non-overlapping initial particle
+positions inside a box, either on a dense lattice (hexagonal in 2D,
+face-centered cubic in 3D, cubic otherwise) or by Poisson-disk sampling
+accelerated by a background grid.
+***********************************************************************/
+
+#ifndef PARTICLESEEDING_INCLUDED
+#define PARTICLESEEDING_INCLUDED
+
+#include <stddef.h>
+#include <Math/Math.h>
+#include <Math/RandomEngine.h>
+#include <Geometry/Point.h>
+#include <Geometry/Vector.h>
+#include <Geometry/Box.h>
+
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+namespace ParticleSeeding {
+
+/***********************************************************************
+Returns the lattice spacing at which generateLattice() places about the
+given number of points into the given box.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+ScalarParam
+calcLatticeSpacing(
+    const Geometry::Box<ScalarParam, dimensionParam>& box,
+    size_t numPoints)
+{
+    double volume=1.0;
+    for (int i=0;i<dimensionParam;++i)
+        volume*=double(box.getSize(i));
+    double volumePerPoint=volume/double(numPoints>0 ? numPoints : 1);
+
+    /* Divide by the density of the lattice at unit spacing: */
+    if (dimensionParam==2)
+        return ScalarParam(Math::sqrt(volumePerPoint*Math::sqrt(3.0)/2.0)); // Hexagonal lattice
+    else if (dimensionParam==3)
+        return ScalarParam(Math::pow(volumePerPoint*Math::sqrt(2.0),1.0/3.0)); // Face-centered cubic lattice
+    else
+        return ScalarParam(Math::pow(volumePerPoint,1.0/double(dimensionParam))); // Cubic lattice
+}
+
+/***********************************************************************
+Appends up to maxNumPoints points of a lattice of the given spacing that
+lie inside the given box to the given list, in row-major order; returns
+the number of appended points. In 2D the points form a hexagonal lattice
+and in 3D a face-centered cubic lattice, where each point's nearest
+neighbors are exactly one spacing away; in other dimensions they form a
+cubic lattice.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+size_t
+generateLattice(
+    const Geometry::Box<ScalarParam, dimensionParam>& box,
+    ScalarParam spacing,
+    size_t maxNumPoints,
+    std::vector<Geometry::Point<ScalarParam, dimensionParam> >& points)
+{
+    typedef Geometry::Point<ScalarParam, dimensionParam> Point;
+
+    /* Describe the lattice as a box-shaped unit cell containing one or more basis points: */
+    ScalarParam cellSize[dimensionParam];
+    std::vector<Point> basis;
+    if (dimensionParam==2)
+    {
+        /* Rectangular cell of a hexagonal lattice: */
+        cellSize[0]=spacing;
+        cellSize[1]=spacing*Math::sqrt(ScalarParam(3));
+        Point p=Point::origin;
+        basis.push_back(p);
+        p[0]=spacing*ScalarParam(0.5);
+        p[1]=cellSize[1]*ScalarParam(0.5);
+        basis.push_back(p);
+    }
+    else if (dimensionParam==3)
+    {
+        /* Cubic cell of a face-centered cubic lattice: */
+        ScalarParam a=spacing*Math::sqrt(ScalarParam(2));
+        for (int i=0;i<3;++i)
+            cellSize[i]=a;
+        basis.push_back(Point::origin);
+        for (int i=0;i<3;++i)
+        {
+            Point p=Point::origin;
+            p[(i+1)%3]=a*ScalarParam(0.5);
+            p[(i+2)%3]=a*ScalarParam(0.5);
+            basis.push_back(p);
+        }
+    }
+    else
+    {
+        for (int i=0;i<dimensionParam;++i)
+            cellSize[i]=spacing;
+        basis.push_back(Point::origin);
+    }
+
+    /* Count the unit cells needed to cover the box: */
+    int numCells[dimensionParam];
+    size_t totalNumCells=1;
+    for (int i=0;i<dimensionParam;++i)
+    {
+        numCells[i]=int(Math::floor(box.getSize(i)/cellSize[i]))+1;
+        totalNumCells*=size_t(numCells[i]);
+    }
+
+    /* Visit all unit cells and basis points and keep the points inside the box: */
+    size_t numAdded=0;
+    int cell[dimensionParam];
+    for (int i=0;i<dimensionParam;++i)
+        cell[i]=0;
+    for (size_t c=0;c<totalNumCells&&numAdded<maxNumPoints;++c)
+    {
+        for (typename std::vector<Point>::iterator bIt=basis.begin();bIt!=basis.end()&&numAdded<maxNumPoints;++bIt)
+        {
+            Point p;
+            bool inside=true;
+            for (int i=0;i<dimensionParam;++i)
+            {
+                p[i]=box.min[i]+cellSize[i]*ScalarParam(cell[i])+(*bIt)[i];
+                inside=inside&&p[i]<=box.max[i];
+            }
+            if (inside)
+            {
+                points.push_back(p);
+                ++numAdded;
+            }
+        }
+
+        /* Advance to the next unit cell, letting the last index component vary fastest: */
+        for (int i=dimensionParam-1;i>=0&&++cell[i]==numCells[i];--i)
+            cell[i]=0;
+    }
+
+    return numAdded;
+}
+
+/***********************************************************************
+Appends up to maxNumPoints points inside the given box that are at least
+minDistance apart to the given list, using Bridson's Poisson-disk
+sampling: new points are drawn around active points until no more fit,
+and a background grid with at most one point per cell limits each
+distance check to a few neighboring cells. The box is always filled
+completely; if that takes more than maxNumPoints points, a random subset
+of them is appended. Returns the number of appended points.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+size_t
+generatePoissonDisk(
+    const Geometry::Box<ScalarParam, dimensionParam>& box,
+    ScalarParam minDistance,
+    size_t maxNumPoints,
+    std::vector<Geometry::Point<ScalarParam, dimensionParam> >& points)
+{
+    typedef Geometry::Point<ScalarParam, dimensionParam> Point;
+    typedef Geometry::Vector<ScalarParam, dimensionParam> Vector;
+    const int numCandidates=30; // Number of candidates drawn around an active point before it is retired
+
+    if (maxNumPoints==0)
+        return 0;
+
+    /* Create a background grid whose cells are small enough to hold at most one point each, padded such that the cells around any point inside the box exist: */
+    ScalarParam gridCellSize=minDistance/Math::sqrt(ScalarParam(dimensionParam));
+    int searchRadius=int(Math::ceil(Math::sqrt(double(dimensionParam)))); // Number of grid cells to check in each direction around a candidate
+    int gridSize[dimensionParam];
+    ptrdiff_t gridStrides[dimensionParam];
+    size_t numGridCells=1;
+    for (int i=dimensionParam-1;i>=0;--i)
+    {
+        gridSize[i]=int(Math::floor(box.getSize(i)/gridCellSize))+1;
+        gridStrides[i]=ptrdiff_t(numGridCells);
+        numGridCells*=size_t(gridSize[i]+2*searchRadius);
+    }
+
+    /* Store the samples themselves in the grid, and fill empty cells with a point that is far away from the whole box: */
+    Point farPoint;
+    for (int i=0;i<dimensionParam;++i)
+        farPoint[i]=box.min[i]-ScalarParam(4)*(box.getSize(i)+minDistance);
+    std::vector<Point> grid(numGridCells,farPoint);
+    ScalarParam minDistance2=minDistance*minDistance;
+
+    /* Collect the offsets of all grid cells that can hold a point closer than minDistance, nearest cells first so that most conflicts are found early: */
+    std::vector<std::pair<ScalarParam, ptrdiff_t> > offsets;
+    int offset[dimensionParam];
+    for (int i=0;i<dimensionParam;++i)
+        offset[i]=-searchRadius;
+    while (true)
+    {
+        ScalarParam cellDist2(0);
+        ptrdiff_t indexOffset=0;
+        for (int i=0;i<dimensionParam;++i)
+        {
+            int gap=Math::abs(offset[i])-1;
+            if (gap>0)
+                cellDist2+=Math::sqr(ScalarParam(gap)*gridCellSize);
+            indexOffset+=ptrdiff_t(offset[i])*gridStrides[i];
+        }
+        if (cellDist2<minDistance2)
+            offsets.push_back(std::make_pair(cellDist2,indexOffset));
+
+        int i;
+        for (i=dimensionParam-1;i>=0&&offset[i]==searchRadius;--i)
+            offset[i]=-searchRadius;
+        if (i<0)
+            break;
+        ++offset[i];
+    }
+    std::stable_sort(offsets.begin(),offsets.end(),[](const std::pair<ScalarParam, ptrdiff_t>& a, const std::pair<ScalarParam, ptrdiff_t>& b) { return a.first<b.first; });
+    std::vector<ptrdiff_t> indexOffsets;
+    for (size_t i=0;i<offsets.size();++i)
+        indexOffsets.push_back(offsets[i].second);
+
+    /* Returns the linear index of the grid cell containing a point inside the box: */
+    auto calcGridIndex=[&](const Point& p) {
+        ptrdiff_t index=0;
+        for (int i=0;i<dimensionParam;++i)
+        {
+            int cell=int((p[i]-box.min[i])/gridCellSize);
+            if (cell>=gridSize[i])
+                cell=gridSize[i]-1;
+            index+=ptrdiff_t(cell+searchRadius)*gridStrides[i];
+        }
+        return index;
+    };
+
+    /* Returns true if the point in the given grid cell is at least minDistance away from all samples: */
+    auto isFree=[&](const Point& p, ptrdiff_t gridIndex) {
+        const Point* cellPtr=grid.data()+gridIndex;
+        for (std::vector<ptrdiff_t>::const_iterator oIt=indexOffsets.begin();oIt!=indexOffsets.end();++oIt)
+            if (Geometry::sqrDist(cellPtr[*oIt],p)<minDistance2)
+                return false;
+        return true;
+    };
+
+    double shellVolume=double(1<<dimensionParam); // Volume of the ball of two minimum distances relative to the ball of one minimum distance
+    std::vector<Point> samples;
+    std::vector<size_t> active; // Indices of samples around which new samples may still fit
+
+    Math::RandomEngine& rng=Math::getThreadRandomEngine();
+
+    /* Start from a random point: */
+    Point p;
+    for (int i=0;i<dimensionParam;++i)
+        p[i]=box.min[i]+box.getSize(i)*ScalarParam(rng.uniformCO());
+    grid[calcGridIndex(p)]=p;
+    samples.push_back(p);
+    active.push_back(0);
+
+    while (!active.empty())
+    {
+        /* Pick a random active sample: */
+        size_t activeIndex=size_t(rng.uniformCO()*double(active.size()));
+        if (activeIndex>=active.size())
+            activeIndex=active.size()-1;
+        Point center=samples[active[activeIndex]];
+
+        /* Draw candidates uniformly from the shell of one to two minimum distances around the sample: */
+        bool found=false;
+        for (int candidate=0;candidate<numCandidates&&!found;++candidate)
+        {
+            Vector d;
+            ScalarParam dLen2;
+            do
+            {
+                for (int i=0;i<dimensionParam;++i)
+                    d[i]=ScalarParam(rng.uniformCO()*2.0-1.0);
+                dLen2=d.sqr();
+            }
+            while (dLen2>ScalarParam(1)||dLen2<ScalarParam(1.0e-6));
+            ScalarParam radius=minDistance*ScalarParam(Math::pow(1.0+rng.uniformCO()*(shellVolume-1.0),1.0/double(dimensionParam)));
+            Point q=center+d*(radius/Math::sqrt(dLen2));
+
+            bool inside=true;
+            for (int i=0;i<dimensionParam;++i)
+                inside=inside&&q[i]>=box.min[i]&&q[i]<=box.max[i];
+            if (!inside)
+                continue;
+            ptrdiff_t gridIndex=calcGridIndex(q);
+            if (isFree(q,gridIndex))
+            {
+                grid[gridIndex]=q;
+                active.push_back(samples.size());
+                samples.push_back(q);
+                found=true;
+            }
+        }
+
+        /* Retire the sample if no candidate fit around it: */
+        if (!found)
+        {
+            active[activeIndex]=active.back();
+            active.pop_back();
+        }
+    }
+
+    /* Keep a random subset of the samples if there are too many, so that they still cover the whole box: */
+    size_t numKept=samples.size();
+    if (numKept>maxNumPoints)
+    {
+        for (size_t i=0;i<maxNumPoints;++i)
+            std::swap(samples[i],samples[i+size_t(rng.uniformCO()*double(samples.size()-i))]);
+        numKept=maxNumPoints;
+    }
+
+    points.insert(points.end(),samples.begin(),samples.begin()+numKept);
+    return numKept;
+}
+
+enum Mode // Enumerated type for the ways generatePositions() spreads particles over a box
+    {
+    Lattice,PoissonDisk
+    };
+
+/***********************************************************************
+Appends up to maxNumPoints positions of non-overlapping spheres of the
+given radius inside the given box to the given list, on a lattice or by
+Poisson-disk sampling, spread out such that about maxNumPoints of them
+fit into the box; returns the number of appended positions.
+***********************************************************************/
+
+template <class ScalarParam, int dimensionParam>
+inline
+size_t
+generatePositions(
+    const Geometry::Box<ScalarParam, dimensionParam>& box,
+    ScalarParam radius,
+    size_t maxNumPoints,
+    Mode mode,
+    std::vector<Geometry::Point<ScalarParam, dimensionParam> >& points)
+{
+    /* Keep the spheres' centers one radius away from the box walls, and the spheres slightly apart: */
+    Geometry::Box<ScalarParam, dimensionParam> centers=box;
+    for (int i=0;i<dimensionParam;++i)
+    {
+        centers.min[i]+=radius;
+        centers.max[i]-=radius;
+    }
+    ScalarParam minDistance=ScalarParam(2)*radius*ScalarParam(1.001);
+    ScalarParam spacing=calcLatticeSpacing(centers,maxNumPoints);
+    if (mode==PoissonDisk)
+    {
+        /* Saturated Poisson-disk samples are about half as dense as a lattice of the same spacing; fill slightly more than requested: */
+        spacing*=ScalarParam(0.7);
+        return generatePoissonDisk(centers,spacing>minDistance?spacing:minDistance,maxNumPoints,points);
+    }
+    else
+        return generateLattice(centers,spacing>minDistance?spacing:minDistance,maxNumPoints,points);
+}
+
+}
+
+#endif